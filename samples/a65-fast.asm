@@ -0,0 +1,162 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; Program to decompress data compressed with the default options:
+;
+;   lz8s input.bin output.lz8
+;
+; This decoder is optimized for speed instead of size: the compressed data is
+; read inline and the copies use self-modifying absolute,Y addressing, with
+; the base address 256 bytes before the end of the block so that Y counts up
+; to zero in the same page. Needs to run from RAM.
+
+; Compression options, must match the ones given to lz8s:
+EXOR_OFFSET = 0         ; Offsets inverted, "-x"
+EOS_MARKER  = 0         ; Data ends with a zero literal and zero match, "-e"
+
+dst = $80
+src = $82
+
+        org $600
+
+        lda 88
+        sta dst
+        lda 89
+        sta dst+1
+        lda #<(input_data)
+        sta src
+        lda #>(input_data)
+        sta src+1
+        ; Y is always 0 when reading from the compressed data
+        ldy #0
+
+; src: pointer to source data
+; dst: pointer to destination data
+get_literal:
+.if !EOS_MARKER
+        lda src
+        cmp #<end_data
+        bne @+
+        lda src+1
+        cmp #>end_data
+        bne @+
+        rts
+@:
+.endif
+        lda (src),y
+        inc src
+        bne @+
+        inc src+1
+@:      tax
+.if EOS_MARKER
+        beq zero_lit
+.else
+        beq get_match
+.endif
+        ; Advance source, copy from 256 bytes before the new position
+        clc
+        adc src
+        sta src
+        sta lsrc+1
+        lda src+1
+        adc #0
+        sta src+1
+        sbc #0          ; Carry is clear, subtracts one
+        sta lsrc+2
+        ; Advance destination, same as above
+        txa
+        clc
+        adc dst
+        sta dst
+        sta ldst+1
+        lda dst+1
+        adc #0
+        sta dst+1
+        sbc #0
+        sta ldst+2
+        ; Y = 256 - count
+        txa
+        eor #$FF
+        tay
+        iny
+lsrc:   lda $FFFF,y
+ldst:   sta $FFFF,y
+        iny
+        bne lsrc
+
+get_match:
+.if !EOS_MARKER
+        lda src
+        cmp #<end_data
+        bne @+
+        lda src+1
+        cmp #>end_data
+        bne @+
+        rts
+@:
+.endif
+        lda (src),y
+        inc src
+        bne @+
+        inc src+1
+@:      tax
+        beq get_literal
+got_match:
+        ; Advance destination, copy to 256 bytes before the new position
+        clc
+        adc dst
+        sta dst
+        sta mdst+1
+        lda dst+1
+        adc #0
+        sta dst+1
+        sbc #0
+        sta mdst+2
+        ; Copy from the offset plus one bytes before the destination
+        lda mdst+1
+        clc
+.if EXOR_OFFSET
+        adc (src),y
+        sta msrc+1
+        lda mdst+2
+        adc #$FF
+.else
+        sbc (src),y     ; Carry is clear, subtracts offset plus one
+        sta msrc+1
+        lda mdst+2
+        sbc #0
+.endif
+        sta msrc+2
+        inc src
+        bne @+
+        inc src+1
+@:      ; Y = 256 - count
+        txa
+        eor #$FF
+        tay
+        iny
+msrc:   lda $FFFF,y
+mdst:   sta $FFFF,y
+        iny
+        bne msrc
+        jmp get_literal
+
+.if EOS_MARKER
+zero_lit:
+        ; A zero match after a zero literal is the end marker
+        lda (src),y
+        inc src
+        bne @+
+        inc src+1
+@:      tax
+        bne got_match
+        rts
+.endif
+decoder_end:
+
+input_data:
+        ins 'data.lz8'
+end_data:
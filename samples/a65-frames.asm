@@ -0,0 +1,164 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; Animation player with double buffered screens, for data compressed with:
+;
+;   lz8s -F 960 -o 16 -A 0 anim.bin anim.lz8
+;
+; Each frame is decoded to the back buffer, copying matches from the frame
+; currently shown, then the buffers are swapped.
+
+FSIZE   = 960           ; Frame size, from "lz8s -F"
+
+RTCLOK  = $12
+SDLSTL  = $230
+
+dst = $80               ; Pointer to new frame
+src = $82               ; Pointer to compressed data
+tmp = $84               ; Pointer to match data
+old = $86               ; Pointer to previous frame
+dend = $88              ; End of new frame
+dlist = $8A             ; Display list
+setx = $8C
+
+buf1 = $4000
+buf2 = $4400
+
+        org $2000
+
+start:
+        lda SDLSTL
+        sta dlist
+        lda SDLSTL+1
+        sta dlist+1
+        lda #<anim_data
+        sta src
+        lda #>anim_data
+        sta src+1
+        ; First frame is decoded from an all-zero frame
+        lda #<buf2
+        sta old
+        lda #>buf2
+        sta old+1
+        lda #<buf1
+        sta dst
+        lda #>buf1
+        sta dst+1
+        ldy #0
+        tya
+clear:  sta buf2,y
+        sta buf2+$100,y
+        sta buf2+$200,y
+        sta buf2+$300,y
+        iny
+        bne clear
+
+play:
+        jsr decode_frame
+
+        ; Swap buffers, dst points after the new frame
+        ldx old
+        ldy old+1
+        sec
+        lda dst
+        sbc #<FSIZE
+        sta old
+        lda dst+1
+        sbc #>FSIZE
+        sta old+1
+        stx dst
+        sty dst+1
+
+        ; Wait for next frame and show new buffer
+        lda RTCLOK+2
+wait:   cmp RTCLOK+2
+        beq wait
+        ldy #4
+        lda old
+        sta (dlist),y
+        iny
+        lda old+1
+        sta (dlist),y
+
+        ; Restart at end of data
+        lda src
+        cmp #<end_data
+        bne play
+        lda src+1
+        cmp #>end_data
+        bne play
+        beq start
+
+; Decodes one frame from src to dst, reading matches from old
+decode_frame:
+        clc
+        lda dst
+        adc #<FSIZE
+        sta dend
+        lda dst+1
+        adc #>FSIZE
+        sta dend+1
+get_literal:
+        jsr get_count
+        tay
+        beq get_match
+        jsr put_byte
+        jsr check_end
+get_match:
+        jsr get_count
+        tay
+        beq get_literal
+        ; Match address is relative to the old frame
+        jsr get_byte
+        clc
+        adc old
+        sta tmp
+        jsr get_byte
+        adc old+1
+        sta tmp+1
+        ldx #2
+        jsr put_byte
+        jsr check_end
+        jmp get_literal
+
+; Returns from decode_frame at end of frame
+check_end:
+        lda dst
+        cmp dend
+        bne @+
+        lda dst+1
+        cmp dend+1
+        bne @+
+        pla
+        pla
+@:      rts
+
+get_count:
+        ldx #0
+
+get_byte:
+        lda (src,x)
+        inc src,x
+        bne @+
+        inc src+1,x
+@:      rts
+
+put_byte:
+        stx setx
+ploop:  ldx setx
+        jsr get_byte
+        ldx #0
+        sta (dst,x)
+        inc dst
+        bne @+
+        inc dst+1
+@       dey
+        bne ploop
+        rts
+
+anim_data:
+        ins 'anim.lz8'
+end_data:
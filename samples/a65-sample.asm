@@ -6,11 +6,32 @@
 ;
 ; Program to decompress data compressed with lz8s -x
 
+; Compression options, must match the ones given to lz8s:
+OFFSET_BITS = 8         ; Offset bits, "-o", 0, 8 or 16
+EXOR_OFFSET = 1         ; Offsets inverted, "-x"
+ZERO_OFFSET = 0         ; Offset on zero length matches, "-n"
+LONG_COUNT  = 0         ; Max lengths bigger than 255, "-l 32895 -m 32895"
+VAR_OFFSET  = 0         ; Offsets of one or two bytes, "-o 16 -w"
+REPEAT_OFFSET = 0       ; Repeat last offset, "-r", only with 8 or 16 bit offsets
+HOT_OFFSETS = 0         ; Number of hot offsets, "-k", only with 8 or 16 bit offsets
+EOS_MARKER  = 0         ; Data ends with a zero literal and zero match, "-e"
+
+; Size of the table of hot offsets, at the start of the data
+HOT_SIZE = HOT_OFFSETS * OFFSET_BITS / 8
+
+; Repeat and hot offsets use the top bit of the match count, so the match
+; counts are never long counts
+.if LONG_COUNT && (REPEAT_OFFSET || HOT_OFFSETS)
+        .error 'LONG_COUNT can not be used with REPEAT_OFFSET or HOT_OFFSETS'
+.endif
+
 dst = $80
 src = $82
 tmp = $84
 setx= $86
 cnt = $87
+cnth= $88
+roff= $89
 
         org $600
 
@@ -18,42 +39,230 @@ cnt = $87
         sta dst
         lda 89
         sta dst+1
-        lda #<(input_data)
+        lda #<(input_data + HOT_SIZE)
         sta src
-        lda #>(input_data)
+        lda #>(input_data + HOT_SIZE)
         sta src+1
+.if REPEAT_OFFSET
+        ; Initial offset is 1
+        lda #$FF
+        sta roff
+        sta roff+1
+.endif
+.if !EOS_MARKER
         ; Number of compressed blocks
         lda #18
         sta cnt
+.endif
 
 ; src: pointer to source data
 ; dst: pointer to destination data
 ; tmp: temporary
 get_literal:
+.if !EOS_MARKER
         dec cnt
         beq do_end
+.endif
         jsr get_count
+.if !LONG_COUNT
         tay
+.endif
+.if EOS_MARKER
+        beq zero_lit
+.else
         beq get_match
+.endif
         jsr put_byte
 get_match:
         jsr get_count
+.if !LONG_COUNT
         tay
+.endif
+got_match:
+.if REPEAT_OFFSET
+        bmi rep_off     ; Top bit set, same offset as last match
+.endif
+.if HOT_OFFSETS
+        bmi hot_off     ; Top bit set, offset from the hot offsets table
+.endif
+.if ZERO_OFFSET && OFFSET_BITS
+        php             ; Offset is always present, test count after it
+.else
         beq get_literal
+.endif
+.if VAR_OFFSET
+        ; Offset of one byte if less than 128, else two bytes as long counts
+        jsr get_byte
+        cmp #$80
+        bcc short_off   ; X = 0, high part of offset
+        sta tmp
         jsr get_byte
+        lsr
+        tax
+        lda tmp
+        bcc short_off
+        and #$7F
+        inx
+short_off:
+        eor #$FF
+.if REPEAT_OFFSET
+        sta roff
+.endif
         clc
-;        eor #$FF       ; This is needed for lz8s without '-x'
         adc dst
         sta tmp
+        txa
+        eor #$FF
+.if REPEAT_OFFSET
+        sta roff+1
+.endif
+        adc dst+1
+.else
+.if OFFSET_BITS == 0
+        lda #$FF        ; Without offsets, copy from last byte
+.else
+        jsr get_byte
+.if !EXOR_OFFSET
+        eor #$FF        ; This is needed for lz8s without '-x'
+.endif
+.endif
+.if REPEAT_OFFSET
+        sta roff
+.endif
+        clc
+        adc dst
+        sta tmp
+.if OFFSET_BITS == 16
+        jsr get_byte
+.if !EXOR_OFFSET
+        eor #$FF
+.endif
+.if REPEAT_OFFSET
+        sta roff+1
+.endif
+        adc dst+1
+.else
         lda dst+1
         adc #$FF
+.endif
+.endif
         sta tmp+1
+.if ZERO_OFFSET && OFFSET_BITS
+        plp
+        beq get_literal
+.endif
+copy_match:
         ldx #2
         jsr put_byte
         beq get_literal
 
+.if EOS_MARKER
+zero_lit:
+        ; A zero match after a zero literal is the end marker
+        jsr get_count
+.if !LONG_COUNT
+        tay
+.endif
+        bne got_match
+        rts
+.endif
+
+.if REPEAT_OFFSET
+rep_off:
+        and #$7F
+        tay
+        lda roff
+        clc
+        adc dst
+        sta tmp
+.if OFFSET_BITS == 16
+        lda roff+1
+        adc dst+1
+.else
+        lda dst+1
+        adc #$FF
+.endif
+        sta tmp+1
+        jmp copy_match
+.endif
+
+.if HOT_OFFSETS
+hot_off:
+        ; Count in the low bits, table index in the high bits
+        and #$7F
+        tax
+        and #(128 / HOT_OFFSETS - 1)
+        tay
+        iny
+        txa
+        lsr
+        lsr
+.if HOT_SIZE < 32
+        lsr
+.endif
+.if HOT_SIZE < 16
+        lsr
+.endif
+.if HOT_SIZE < 8
+        lsr
+.endif
+.if HOT_SIZE < 4
+        lsr
+.endif
+.if HOT_SIZE < 2
+        lsr
+.endif
+.if OFFSET_BITS == 16
+        and #$FE
+.endif
+        tax
+        lda input_data,x
+.if !EXOR_OFFSET
+        eor #$FF
+.endif
+        clc
+        adc dst
+        sta tmp
+.if OFFSET_BITS == 16
+        lda input_data+1,x
+.if !EXOR_OFFSET
+        eor #$FF
+.endif
+        adc dst+1
+.else
+        lda dst+1
+        adc #$FF
+.endif
+        sta tmp+1
+        jmp copy_match
+.endif
+
+.if LONG_COUNT
+; Reads a count, returns low part in Y, and the number of
+; loops of the copy in "cnth", zero flag set if count is 0.
 get_count:
         ldx #0
+        stx cnth
+        jsr get_byte
+        tay
+        bpl short_count
+        jsr get_byte
+        lsr
+        sta cnth
+        tya
+        bcc @+
+        and #$7F
+        inc cnth
+@:      tay
+short_count:
+        beq @+
+        inc cnth
+@:      lda cnth
+        rts
+.else
+get_count:
+        ldx #0
+.endif
 
 get_byte:
         lda (src,x)
@@ -74,7 +283,12 @@ ploop:  ldx setx
         inc dst+1
 @       dey
         bne ploop
+.if LONG_COUNT
+        dec cnth
+        bne ploop
+.endif
         rts
+decoder_end:
 
 input_data:
         .byte 1,14,138,255,1,138,38,116,3,212,239,212,39,217,0,36
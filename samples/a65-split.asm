@@ -0,0 +1,159 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; Program to decompress data compressed with split streams:
+;
+;   lz8s -p -x input.bin output.lz8
+;
+; The counts and offsets are read from the control stream and the literal
+; bytes from the literal stream, so both copies are simple indexed loops
+; and the pointers are updated once per block.
+
+; Compression options, must match the ones given to lz8s:
+OFFSET_BITS = 8         ; Offset bits, "-o", 8 or 16
+EXOR_OFFSET = 1         ; Offsets inverted, "-x"
+EOS_MARKER  = 0         ; Data ends with a zero literal and zero match, "-e"
+
+dst = $80
+src = $82
+tmp = $84
+lit = $86
+cnt = $88
+cend= $89
+
+        org $600
+
+        lda 88
+        sta dst
+        lda 89
+        sta dst+1
+        ; Control stream starts after the header, and ends at the literals
+        lda #<(input_data + 2)
+        sta src
+        lda #>(input_data + 2)
+        sta src+1
+        clc
+        lda input_data
+        adc #<input_data
+        sta lit
+        sta cend
+        lda input_data+1
+        adc #>input_data
+        sta lit+1
+        sta cend+1
+
+; src: pointer to control stream
+; lit: pointer to literal stream
+; dst: pointer to destination data
+; tmp: match source
+; cend: end of control stream
+get_literal:
+        jsr get_count
+.if EOS_MARKER
+        beq zero_lit
+.else
+        beq get_match
+.endif
+        ldy #0
+lcopy:  lda (lit),y
+        sta (dst),y
+        iny
+        cpy cnt
+        bne lcopy
+        tya
+        clc
+        adc lit
+        sta lit
+        bcc @+
+        inc lit+1
+@:      tya
+        jsr add_dst
+get_match:
+        jsr get_count
+        beq get_literal
+got_match:
+        ldy #0
+        lda (src),y
+.if !EXOR_OFFSET
+        eor #$FF        ; This is needed for lz8s without '-x'
+.endif
+        clc
+        adc dst
+        sta tmp
+.if OFFSET_BITS == 16
+        iny
+        lda (src),y
+.if !EXOR_OFFSET
+        eor #$FF
+.endif
+        adc dst+1
+.else
+        lda dst+1
+        adc #$FF
+.endif
+        sta tmp+1
+        ; Skip offset
+        tya
+        sec
+        adc src
+        sta src
+        bcc @+
+        inc src+1
+@:      ldy #0
+mcopy:  lda (tmp),y
+        sta (dst),y
+        iny
+        cpy cnt
+        bne mcopy
+        tya
+        jsr add_dst
+        jmp get_literal
+
+.if EOS_MARKER
+zero_lit:
+        ; A zero match after a zero literal is the end marker
+        jsr get_count
+        bne got_match
+        rts
+.endif
+
+; Adds A to the destination pointer
+add_dst:
+        clc
+        adc dst
+        sta dst
+        bcc @+
+        inc dst+1
+@:      rts
+
+; Reads a count from the control stream into "cnt", zero flag set if 0.
+; At the end of the control stream, returns from the decoder.
+get_count:
+.if !EOS_MARKER
+        lda src
+        cmp cend
+        bne @+
+        lda src+1
+        cmp cend+1
+        beq do_end
+@:
+.endif
+        ldy #0
+        lda (src),y
+        inc src
+        bne @+
+        inc src+1
+@:      sta cnt
+        tax
+        rts
+do_end: pla
+        pla
+        rts
+decoder_end:
+
+input_data:
+        ins 'data.lz8'
+end_data:
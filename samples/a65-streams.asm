@@ -0,0 +1,158 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; POKEY register dump player, for music compressed with:
+;
+;   lz8s -i 9 -o 4 -x music.sapr music.lz8
+;
+; Each POKEY register is compressed as a separate stream, and all streams are
+; decoded in lockstep, one byte of each stream per frame. As each stream uses
+; only a 16 byte window, all the windows fit in one page of memory.
+
+NSTREAM = 9             ; Number of streams, from "lz8s -i"
+RMASK   = $0F           ; Window mask, (1 << bits) - 1 from "lz8s -o"
+
+RTCLOK  = $12
+POKEY   = $D200
+
+; Per stream state, indexed by X = stream * 2
+src     = $80                   ; Pointer to compressed data
+cnt     = src + NSTREAM*2       ; Bytes left in current block
+kind    = cnt + 1               ; 1 = in literal, 0 = in match
+mpos    = cnt + NSTREAM*2       ; Window read position for match
+wpos    = mpos + 1              ; Window write position
+rbase   = mpos + NSTREAM*2      ; Start of the window inside the page
+reg     = rbase + 1             ; POKEY register of the stream
+send    = rbase + NSTREAM*2     ; End of first stream data
+
+; Windows for all streams
+ring    = $0600
+
+        org $2000
+
+start:
+        jsr init_song
+play:
+        ; Wait for next frame
+        lda RTCLOK+2
+wait:   cmp RTCLOK+2
+        beq wait
+
+        jsr play_frame
+        jmp play
+
+; Initializes decoding of all streams from the header
+init_song:
+        ldx #0
+        ldy #0
+init:   clc
+        lda song,x
+        adc #<song
+        sta src,x
+        lda song+1,x
+        adc #>song
+        sta src+1,x
+        sty rbase,x
+        tya
+        clc
+        adc #RMASK+1
+        tay
+        txa
+        lsr
+        sta reg,x
+        lda #0
+        sta cnt,x
+        sta kind,x
+        sta wpos,x
+        inx
+        inx
+        cpx #NSTREAM*2
+        bne init
+
+        ; First stream ends at the start of the second one
+        lda src+2
+        sta send
+        lda src+3
+        sta send+1
+        rts
+
+; Decodes one byte of each stream and writes it to POKEY,
+; restarts the song at the end of the data.
+play_frame:
+        ; First stream is the longest, check if it is at the end
+        lda cnt
+        bne frame
+        lda src
+        cmp send
+        bne frame
+        lda src+1
+        cmp send+1
+        beq init_song
+
+frame:  ldx #0
+floop:  jsr get_byte
+        ldy reg,x
+        sta POKEY,y
+        inx
+        inx
+        cpx #NSTREAM*2
+        bne floop
+        rts
+
+; Returns in A the next decoded byte from stream X
+get_byte:
+        lda cnt,x
+        bne got_block
+new_block:
+        ; Switch between literal and match, read new count
+        lda kind,x
+        eor #1
+        sta kind,x
+        jsr read_src
+        sta cnt,x
+        tay
+        beq new_block
+        lda kind,x
+        bne got_block
+        ; Match, read offset and get window position
+        jsr read_src
+;        eor #$FF       ; This is needed for lz8s without '-x'
+        clc
+        adc wpos,x
+        sta mpos,x
+got_block:
+        dec cnt,x
+        lda kind,x
+        beq copy_match
+        jsr read_src
+        jmp store
+copy_match:
+        lda mpos,x
+        inc mpos,x
+        and #RMASK
+        ora rbase,x
+        tay
+        lda ring,y
+store:
+        pha
+        lda wpos,x
+        inc wpos,x
+        and #RMASK
+        ora rbase,x
+        tay
+        pla
+        sta ring,y
+        rts
+
+read_src:
+        lda (src,x)
+        inc src,x
+        bne @+
+        inc src+1,x
+@:      rts
+
+song:
+        ins 'music.lz8'
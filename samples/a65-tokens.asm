@@ -0,0 +1,122 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; Program to decompress data compressed with nibble tokens:
+;
+;   lz8s -t -x input.bin output.lz8
+;
+; Each token byte holds the literal count in the high nibble and the match
+; count in the low nibble, a count of 15 is followed by an extension byte.
+
+; Compression options, must match the ones given to lz8s:
+OFFSET_BITS = 8         ; Offset bits, "-o", 8 or 16
+EXOR_OFFSET = 1         ; Offsets inverted, "-x"
+EOS_MARKER  = 0         ; Data ends with a zero token, "-e"
+
+dst = $80
+src = $82
+tmp = $84
+setx= $86
+tok = $87
+
+        org $600
+
+        lda 88
+        sta dst
+        lda 89
+        sta dst+1
+        lda #<(input_data)
+        sta src
+        lda #>(input_data)
+        sta src+1
+
+; src: pointer to source data
+; dst: pointer to destination data
+; tmp: temporary
+check_end:
+.if !EOS_MARKER
+        lda src
+        cmp #<end_data
+        bne get_token
+        lda src+1
+        cmp #>end_data
+        beq do_end
+.endif
+get_token:
+        ldx #0
+        jsr get_byte
+.if EOS_MARKER
+        cmp #0          ; Zero token is the end marker
+        beq do_end
+.endif
+        sta tok
+        lsr
+        lsr
+        lsr
+        lsr
+        beq get_match
+        cmp #15         ; Count of 15 is followed by an extension byte
+        bne @+
+        jsr get_byte
+        adc #14         ; Carry is set from the compare
+@:      tay
+        jsr put_byte
+get_match:
+        lda tok
+        and #$0F
+        beq check_end
+        cmp #15
+        bne @+
+        jsr get_byte
+        adc #14
+@:      tay
+        jsr get_byte
+.if !EXOR_OFFSET
+        eor #$FF        ; This is needed for lz8s without '-x'
+.endif
+        clc
+        adc dst
+        sta tmp
+.if OFFSET_BITS == 16
+        jsr get_byte
+.if !EXOR_OFFSET
+        eor #$FF
+.endif
+        adc dst+1
+.else
+        lda dst+1
+        adc #$FF
+.endif
+        sta tmp+1
+        ldx #2
+        jsr put_byte
+        beq check_end
+
+get_byte:
+        lda (src,x)
+        inc src,x
+        bne @+
+        inc src+1,x
+@:
+do_end: rts
+
+put_byte:
+        stx setx
+ploop:  ldx setx
+        jsr get_byte
+        ldx #0
+        sta (dst,x)
+        inc dst
+        bne @+
+        inc dst+1
+@       dey
+        bne ploop
+        rts
+decoder_end:
+
+input_data:
+        ins 'data.lz8'
+end_data:
@@ -0,0 +1,85 @@
+; LZ8S ultra-simple LZ based compressor
+; -------------------------------------
+;
+; (c) 2025 DMSC
+; Code under MIT license, see LICENSE file.
+;
+; Z80 program to decompress data compressed with the default options, or
+; with 16 bit offsets:
+;
+;   lz8s input.bin output.lz8
+;   lz8s -o 16 input.bin output.lz8
+;
+; Literals and matches are copied with LDIR, this also works for matches
+; that overlap the output, as LDIR copies one byte at a time.
+
+; Compression options, must match the ones given to lz8s:
+OFFSET_BITS equ 8       ; Offset bits, "-o", 8 or 16
+
+        org $8000
+
+        ld hl,input_data
+        ld de,$4000             ; Output to the screen
+
+; HL: pointer to source data
+; DE: pointer to destination data
+get_literal:
+        ld a,l
+        cp end_data & 255
+        jr nz,lit_count
+        ld a,h
+        cp end_data / 256
+        ret z
+lit_count:
+        ld a,(hl)
+        inc hl
+        or a
+        jr z,get_match
+        ld c,a
+        ld b,0
+        ldir
+get_match:
+        ld a,l
+        cp end_data & 255
+        jr nz,match_count
+        ld a,h
+        cp end_data / 256
+        ret z
+match_count:
+        ld a,(hl)
+        inc hl
+        or a
+        jr z,get_literal
+        ld c,a
+        ld b,0
+        ; Copy from the offset plus one bytes before the destination,
+        ; the inverted offset is minus the offset minus one.
+    if OFFSET_BITS == 16
+        ld a,(hl)
+        inc hl
+        ld b,(hl)
+        inc hl
+        push hl
+        cpl
+        ld l,a
+        ld a,b
+        cpl
+        ld h,a
+        ld b,0
+    else
+        ld a,(hl)
+        inc hl
+        push hl
+        cpl
+        ld l,a
+        ld h,$FF
+    endif
+        add hl,de
+        ldir
+        pop hl
+        jr get_literal
+decoder_end:
+
+input_data:
+        incbin "data.lz8"
+end_data:
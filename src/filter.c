@@ -0,0 +1,167 @@
+/*
+ * LZ8S ultra-simple LZ based compressor
+ * -------------------------------------
+ *
+ * (c) 2025 DMSC
+ * Code under MIT license, see LICENSE file.
+ */
+#include "filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int filter_parse(struct filter *f, const char *str)
+{
+    static const struct {
+        const char *name;
+        enum filter_type type;
+        int min, max;
+    } names[] = {
+        { "none",      FILTER_NONE,      0, 0 },
+        { "delta",     FILTER_DELTA,     0, 0 },
+        { "transpose", FILTER_TRANSPOSE, 1, 65535 },
+        { "bitplane",  FILTER_BITPLANE,  2, 8 },
+        { "columns",   FILTER_COLUMNS,   1, 65535 },
+    };
+    const char *sep = strchr(str, ':');
+    int len = sep ? sep - str : (int)strlen(str);
+
+    for(unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if( strncmp(str, names[i].name, len) || names[i].name[len] )
+            continue;
+        f->type = names[i].type;
+        f->arg = sep ? atoi(sep + 1) : 0;
+        if( !names[i].max )
+            return sep ? -1 : 0;
+        if( f->arg < names[i].min || f->arg > names[i].max )
+            return -1;
+        // Bit-planes only for pixels of 2, 4 or 8 bits
+        if( f->type == FILTER_BITPLANE && (f->arg & (f->arg - 1)) )
+            return -1;
+        return 0;
+    }
+    return -1;
+}
+
+const char *filter_name(const struct filter *f, char *buf, int len)
+{
+    switch( f->type )
+    {
+        case FILTER_NONE:
+            snprintf(buf, len, "none");
+            break;
+        case FILTER_DELTA:
+            snprintf(buf, len, "delta");
+            break;
+        case FILTER_TRANSPOSE:
+            snprintf(buf, len, "transpose:%d", f->arg);
+            break;
+        case FILTER_BITPLANE:
+            snprintf(buf, len, "bitplane:%d", f->arg);
+            break;
+        case FILTER_COLUMNS:
+            snprintf(buf, len, "columns:%d", f->arg);
+            break;
+    }
+    return buf;
+}
+
+// Returns the position in the filtered data of the byte at position i,
+// for the column filters.
+static int column_pos(const struct filter *f, int i, int rows)
+{
+    int r = i / f->arg;
+    int c = i % f->arg;
+    if( f->type == FILTER_COLUMNS && (c & 1) )
+        r = rows - 1 - r;
+    return c * rows + r;
+}
+
+// Bit access, with the first bit as the most significant
+static int get_bit(const uint8_t *data, int i)
+{
+    return (data[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static void set_bit(uint8_t *data, int i, int b)
+{
+    if( b )
+        data[i >> 3] |= 0x80 >> (i & 7);
+}
+
+// Returns the bit position in the filtered data of input bit i,
+// for the bit-plane filter.
+static int plane_pos(const struct filter *f, int i, int pixels)
+{
+    int p = i / f->arg;
+    int b = f->arg - 1 - i % f->arg;
+    return b * pixels + p;
+}
+
+static void filter_run(const struct filter *f, uint8_t *data, int size, int revert)
+{
+    uint8_t *tmp;
+    switch( f->type )
+    {
+        case FILTER_NONE:
+            break;
+        case FILTER_DELTA:
+            if( revert )
+            {
+                for(int i = 1; i < size; i++)
+                    data[i] += data[i-1];
+            }
+            else
+            {
+                for(int i = size - 1; i > 0; i--)
+                    data[i] -= data[i-1];
+            }
+            break;
+        case FILTER_TRANSPOSE:
+        case FILTER_COLUMNS:
+        {
+            // Only full rows are reordered
+            int rows = size / f->arg;
+            int len = rows * f->arg;
+            tmp = malloc(len + 1);
+            for(int i = 0; i < len; i++)
+            {
+                if( revert )
+                    tmp[i] = data[column_pos(f, i, rows)];
+                else
+                    tmp[column_pos(f, i, rows)] = data[i];
+            }
+            memcpy(data, tmp, len);
+            free(tmp);
+            break;
+        }
+        case FILTER_BITPLANE:
+        {
+            // Only groups of 8 pixels are reordered
+            int len = size / f->arg * f->arg;
+            int pixels = len * 8 / f->arg;
+            tmp = calloc(len + 1, 1);
+            for(int i = 0; i < len * 8; i++)
+            {
+                if( revert )
+                    set_bit(tmp, i, get_bit(data, plane_pos(f, i, pixels)));
+                else
+                    set_bit(tmp, plane_pos(f, i, pixels), get_bit(data, i));
+            }
+            memcpy(data, tmp, len);
+            free(tmp);
+            break;
+        }
+    }
+}
+
+void filter_apply(const struct filter *f, uint8_t *data, int size)
+{
+    filter_run(f, data, size, 0);
+}
+
+void filter_revert(const struct filter *f, uint8_t *data, int size)
+{
+    filter_run(f, data, size, 1);
+}
@@ -0,0 +1,37 @@
+/*
+ * LZ8S ultra-simple LZ based compressor
+ * -------------------------------------
+ *
+ * (c) 2025 DMSC
+ * Code under MIT license, see LICENSE file.
+ */
+#pragma once
+#include <stdint.h>
+
+// Reversible filters applied to the data before compression
+enum filter_type {
+    FILTER_NONE,
+    FILTER_DELTA,       // Difference with previous byte
+    FILTER_TRANSPOSE,   // Rows of W bytes, stored by columns
+    FILTER_BITPLANE,    // Pixels of N bits, stored by bit-planes
+    FILTER_COLUMNS      // Rows of W bytes, stored by columns up and down
+};
+
+struct filter
+{
+    enum filter_type type;
+    int arg;
+};
+
+// Parses filter name with optional argument, as "name:arg".
+// Returns 0 on success, -1 on error.
+int filter_parse(struct filter *f, const char *str);
+
+// Writes the filter name to the buffer, to show to the user.
+const char *filter_name(const struct filter *f, char *buf, int len);
+
+// Applies the filter to the data, in place.
+void filter_apply(const struct filter *f, uint8_t *data, int size);
+
+// Reverts the filter from the data, in place.
+void filter_revert(const struct filter *f, uint8_t *data, int size);
@@ -6,10 +6,12 @@
  * Code under MIT license, see LICENSE file.
  */
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "filter.h"
 
 #ifdef _WIN32
 #include <io.h>
@@ -31,17 +33,130 @@ static int max_llen = 255;      // Maximum literal length (unlimited in LZ4)
 static int zero_offset = 0;     // Do not read offset on matches of length 0
 static int offset_rel = -1;     // Offset relative or absolute
 static int exor_offset = 0;     // Write inverse of offset
+static int var_offset = 0;      // Offsets of one byte if less than 128, two bytes if not
+static int rep_offset = 0;      // Match count with top bit set repeats last offset
+static int nibble_tokens = 0;   // Literal and match counts in one token byte
+static int num_streams = 1;     // Number of interleaved streams
+static int frame_size = 0;      // Frame size, matches only from previous frame
+static int block_size = 0;      // Block size, options read on each block
+static int split_streams = 0;   // Literal bytes in a separate stream
+static int end_marker = 0;      // Data ends with a zero literal and zero match
+static int hot_num = 0;         // Number of hot offsets, coded in the match count
+static int hot_mlen = 0;        // Max match length with a hot offset
+static unsigned hot_off[16];    // Hot offsets, read from the start of the data
+static uint8_t *preset_data;    // Preset window, placed before the output
+static int preset_size = 0;     // Size of the preset window
+static int chunk_size = 0;      // Average chunk size, each chunk with a size header
+
+// Output buffer, to apply the filter after decoding
+static uint8_t *out_buf;
+static int out_len, out_size;
+
+static void put_byte(int x)
+{
+    if( out_len >= out_size )
+    {
+        out_size = out_size ? out_size * 2 : 65536;
+        out_buf = realloc(out_buf, out_size);
+    }
+    out_buf[out_len++] = x;
+}
+
+// Decoder state, allows decoding one byte at a time
+struct lzd
+{
+    const uint8_t *src; // Compressed data
+    const uint8_t *end; // End of compressed data
+    const uint8_t *lit; // Literal bytes, in split streams
+    const uint8_t *lend;// End of literal bytes
+    uint8_t *buf;       // Window, linear with more than 16 bit offsets
+    unsigned size;      // Window size
+    const uint8_t *ref; // Previous frame, in frame mode
+    unsigned pos;       // Current output position
+    unsigned off;       // Current match position
+    unsigned rep;       // Last match offset read
+    int mtok;           // Match count from last token
+    int len;            // Bytes remaining on current block
+    int lzero;          // Last literal count was zero
+    int in_match;       // Current block is a match
+};
+
+static void lzd_init(struct lzd *d, const uint8_t *src, const uint8_t *end)
+{
+    d->size = 65536;
+    d->buf = calloc(d->size, 1);
+    d->ref = 0;
+    d->src = src;
+    d->end = end;
+    d->lit = 0;
+    d->lend = 0;
+    d->pos = 0;
+    d->off = 0;
+    d->rep = 0;
+    d->mtok = 0;
+    d->len = 0;
+    d->lzero = 0;
+    d->in_match = 1;
+}
+
+static void lzd_free(struct lzd *d)
+{
+    free(d->buf);
+}
+
+// Read one byte from the compressed data
+static int get_byte(struct lzd *d)
+{
+    if( d->src >= d->end )
+        return EOF;
+    return *d->src++;
+}
+
+// Window mask, blocks can change the offset bits, so the window is always 64k
+static unsigned window_mask(void)
+{
+    return bits_moff > 16 ? 0xFFFFFFFF : (bits_moff > 8 || block_size) ? 0xFFFF : 0xFF;
+}
+
+// Stores one output byte in the window
+static void put_window(struct lzd *d, int x)
+{
+    unsigned mask = window_mask();
+    if( d->ref )
+        d->buf[d->pos] = x;
+    else
+    {
+        // Linear window grows with the output
+        if( (d->pos & mask) >= d->size )
+        {
+            d->size *= 2;
+            d->buf = realloc(d->buf, d->size);
+        }
+        d->buf[d->pos & mask] = x;
+    }
+    d->pos++;
+}
+
+// Read one literal byte, from the literal stream if split
+static int get_lit(struct lzd *d)
+{
+    if( !d->lit )
+        return get_byte(d);
+    if( d->lit >= d->lend )
+        return EOF;
+    return *d->lit++;
+}
 
 // Read match/literal length - depends on max length
-static int get_len(int max)
+static int get_len(struct lzd *d, int max)
 {
-    int c = getchar();
+    int c = get_byte(d);
     if( c == EOF )
         return -1;
     if(max < 256 || c < 128)
         return c;
-    int c2 = getchar();
-    if( c == EOF )
+    int c2 = get_byte(d);
+    if( c2 == EOF )
     {
         fprintf(stderr, "ERROR, end of file reading second byte of length");
         return -1;
@@ -49,78 +164,408 @@ static int get_len(int max)
     return c + (c2 << 7);
 }
 
-// Decoding function - this is extremely simple (by design!)
-int decode(void)
+// Read match offset, returns -1 at end of data
+static int get_off(struct lzd *d, unsigned *off)
 {
-    // Maximum window: 16bit
-    char buf[65536];
-    unsigned pos = 0;
-    unsigned mask = bits_moff > 8 ? 0xFFFF : 0xFF;
-    int n, x;
+    *off = 0;
+    // Low byte first
+    for(int i = 0; i < bits_moff; i += 8)
+    {
+        int x = get_byte(d);
+        if( x == EOF )
+            return -1;
+        *off |= (unsigned)x << i;
+    }
+    if( exor_offset )
+        *off ^= (unsigned)((1ULL << bits_moff) - 1);
+    return 0;
+}
 
-    while(1)
+// Read extension of a length from a token nibble
+static int get_ext(struct lzd *d, int len, int max)
+{
+    if( len < 15 )
+        return len;
+    int c = get_len(d, max - 15);
+    if( c < 0 )
     {
-        // Decode LITERAL
-        if( (n = get_len(max_llen)) < 0 )
-            return pos;
+        fprintf(stderr, "ERROR, end of file reading length extension.\n");
+        return -1;
+    }
+    return 15 + c;
+}
 
-        // Copy from input (LITERAL)
-        for(int i = 0; i < n; i++)
+// Read token, returns the literal length and stores the match length
+static int get_token(struct lzd *d)
+{
+    int c = get_byte(d);
+    if( c == EOF )
+        return -1;
+    d->mtok = c & 15;
+    return get_ext(d, c >> 4, max_llen);
+}
+
+// Decoding function - this is extremely simple (by design!)
+// Returns the next decoded byte, or -1 at end of data.
+static int decode_byte(struct lzd *d)
+{
+    unsigned mask = window_mask();
+    int x;
+
+    if( d->len < 0 )
+        return -1;
+
+    while( !d->len )
+    {
+        d->in_match = !d->in_match;
+        if( !d->in_match )
+        {
+            // Decode LITERAL
+            if( nibble_tokens )
+                d->len = get_token(d);
+            else
+                d->len = get_len(d, max_llen);
+            if( d->len < 0 )
+                return -1;
+            d->lzero = !d->len;
+        }
+        else
         {
-            if (EOF == (x = getchar()))
+            // Decode MATCH
+            if( nibble_tokens )
+                d->len = get_ext(d, d->mtok, max_mlen);
+            else
+                d->len = get_len(d, max_mlen);
+            if( d->len < 0 )
+                return -1;
+
+            // With tokens, data ends after the last literal
+            if( nibble_tokens && !d->len && d->src >= d->end )
             {
-                fprintf(stderr, "ERROR, short file reading literal.\n");
-                return pos;
+                d->len = -1;
+                return -1;
             }
-            buf[pos & mask] = x;
-            putchar(x);
-            pos++;
-        }
 
-        // Decode MATCH
-        if( (n = get_len(max_mlen)) < 0 )
-            return pos;
+            // A zero match after a zero literal is the end marker
+            if( end_marker && d->lzero && !d->len )
+            {
+                d->len = -1;
+                return -1;
+            }
 
-        if( zero_offset || n )
-        {
-            // Read match offset
-            int off = 0;
-            if(bits_moff > 0)
+            // Top bit set repeats the last offset
+            int rep = rep_offset && d->len > 127;
+            if( rep )
+                d->len &= 0x7F;
+
+            // Or selects a hot offset, with the count in the low bits
+            int hot = hot_num && d->len > 127 ? (d->len & 0x7F) / hot_mlen : -1;
+            if( hot >= 0 )
+                d->len = (d->len & (hot_mlen - 1)) + 1;
+
+            if( rep || hot >= 0 || zero_offset || d->len )
             {
-                if (EOF == (off = getchar()))
+                // Read match offset
+                unsigned off = 0;
+                if( rep )
+                    off = d->rep;
+                else if( hot >= 0 )
+                    off = hot_off[hot];
+                else if( var_offset )
                 {
-                    fprintf(stderr, "ERROR, short file reading match offset.\n");
-                    return pos;
+                    // Same encoding as long counts
+                    int c = get_len(d, 65535);
+                    if( c < 0 )
+                    {
+                        fprintf(stderr, "ERROR, short file reading match offset.\n");
+                        return -1;
+                    }
+                    off = c;
                 }
-            }
-            if(bits_moff > 8)
-            {
-                if (EOF == (x = getchar()))
+                else if( get_off(d, &off) )
                 {
                     fprintf(stderr, "ERROR, short file reading match offset.\n");
-                    return pos;
+                    return -1;
+                }
+                d->rep = off;
+                if( d->ref )
+                {
+                    // Position inside the previous frame
+                    if( offset_rel < 0 && d->len && off >= d->pos + frame_size )
+                    {
+                        fprintf(stderr, "ERROR, match outside of previous frame.\n");
+                        return -1;
+                    }
+                    if( offset_rel < 0 )
+                        d->off = d->pos + frame_size - off - 1;
+                    else
+                        d->off = (off - offset_rel) & mask;
+                    if( d->len && (d->off >= frame_size || d->len > frame_size - d->off) )
+                    {
+                        fprintf(stderr, "ERROR, match outside of previous frame.\n");
+                        return -1;
+                    }
+                }
+                else
+                {
+                    if( offset_rel < 0 )
+                        d->off = d->pos - off + mask;
+                    else if( bits_moff > 16 )
+                    {
+                        // The address is modulo the offset bits, the match is
+                        // the position with that address before the current one
+                        unsigned omask = (unsigned)((1ULL << bits_moff) - 1);
+                        d->off = d->pos - 1 - ((d->pos - off + offset_rel - 1) & omask);
+                    }
+                    else
+                        d->off = off + mask + 1 - offset_rel;
+                    // Linear window, check that the match is inside
+                    if( bits_moff > 16 && d->len && d->off >= d->pos )
+                    {
+                        fprintf(stderr, "ERROR, match before start of data.\n");
+                        return -1;
+                    }
                 }
-                off = off + (x << 8);
             }
-            if( exor_offset )
-                off = mask ^ off;
-            if( offset_rel < 0 )
-                off = pos - off + mask;
-            else
-                off = off + mask + 1 - offset_rel;
+        }
+    }
 
-            // Copy from old output (MATCH)
-            for(int i = 0; i < n; i++)
+    d->len--;
+    if( !d->in_match )
+    {
+        // Copy from input (LITERAL)
+        if (EOF == (x = get_lit(d)))
+        {
+            fprintf(stderr, "ERROR, short file reading literal.\n");
+            return -1;
+        }
+    }
+    else if( d->ref )
+    {
+        // Copy from previous frame (MATCH)
+        x = d->ref[d->off];
+        d->off++;
+    }
+    else
+    {
+        // Copy from old output (MATCH)
+        x = d->buf[d->off & mask];
+        d->off++;
+    }
+    put_window(d, x);
+    return x;
+}
+
+// Decodes a single stream
+static int decode(const uint8_t *data, int size)
+{
+    static struct lzd d;
+    int x;
+
+    lzd_init(&d, data, data + size);
+    if( split_streams )
+    {
+        // Header with the offset of the literals from the start
+        int lstart = size < 2 ? -1 : data[0] + (data[1] << 8);
+        if( lstart < 2 || lstart > size )
+        {
+            fprintf(stderr, "ERROR, invalid split streams header.\n");
+            lzd_free(&d);
+            return 0;
+        }
+        d.src = data + 2;
+        d.end = data + lstart;
+        d.lit = data + lstart;
+        d.lend = data + size;
+    }
+    // Preset window, before the output
+    for(int i = 0; i < preset_size; i++)
+        put_window(&d, preset_data[i]);
+    // Table of hot offsets at the start
+    for(int i = 0; i < hot_num; i++)
+    {
+        if( get_off(&d, &hot_off[i]) )
+        {
+            fprintf(stderr, "ERROR, short file reading hot offsets.\n");
+            lzd_free(&d);
+            return 0;
+        }
+    }
+    while( (x = decode_byte(&d)) >= 0 )
+        put_byte(x);
+    lzd_free(&d);
+    return d.pos - preset_size;
+}
+
+// Decodes frames, matches are copied from the previous frame
+static int decode_frames(const uint8_t *data, int size)
+{
+    static struct lzd d;
+    static uint8_t old[65536];
+    int total = 0;
+
+    lzd_init(&d, data, data + size);
+    memset(old, 0, sizeof(old));
+    d.ref = old;
+    while( d.src < d.end )
+    {
+        // Start a new frame, always with a literal
+        d.pos = 0;
+        d.rep = 0;
+        d.len = 0;
+        d.in_match = 1;
+        while( d.pos < frame_size )
+        {
+            int x = decode_byte(&d);
+            if( x < 0 )
+                break;
+            put_byte(x);
+        }
+        total += d.pos;
+        if( d.len < 0 )
+            break;
+        // Swap buffers - new frame is now the previous one
+        memcpy(old, d.buf, frame_size);
+    }
+    lzd_free(&d);
+    return total;
+}
+
+// Decodes blocks, each one with a header selecting the offset bits and max
+// lengths, matches are copied from all the previous output.
+static int decode_blocks(const uint8_t *data, int size)
+{
+    static struct lzd d;
+
+    lzd_init(&d, data, data + size);
+    while( d.src < d.end )
+    {
+        // Header: number of offset bytes, number of blocks after the first,
+        // top bit set for long counts
+        int h = get_byte(&d);
+        if( (h & 3) > 2 )
+        {
+            fprintf(stderr, "ERROR, invalid block header.\n");
+            break;
+        }
+        bits_moff = (h & 3) * 8;
+        max_llen = max_mlen = (h & 0x80) ? 32895 : 255;
+
+        // Start a new group of blocks, always with a literal
+        unsigned end = d.pos + (((h >> 2) & 31) + 1) * block_size;
+        d.len = 0;
+        d.in_match = 1;
+        while( d.pos < end )
+        {
+            int x = decode_byte(&d);
+            if( x < 0 )
+                break;
+            put_byte(x);
+        }
+        if( d.len < 0 )
+            break;
+    }
+    lzd_free(&d);
+    return d.pos;
+}
+
+// Decodes chunks, each one with a header with the compressed size, matches
+// are copied from all the previous output.
+static int decode_chunks(const uint8_t *data, int size)
+{
+    static struct lzd d;
+    const uint8_t *end = data + size;
+
+    lzd_init(&d, data, data);
+    while( d.src < end )
+    {
+        // Header: compressed size of the chunk
+        if( end - d.src < 2 || d.src[0] + 256 * d.src[1] > end - d.src - 2 )
+        {
+            fprintf(stderr, "ERROR, invalid chunk header.\n");
+            break;
+        }
+        d.end = d.src + 2 + d.src[0] + 256 * d.src[1];
+        d.src += 2;
+
+        // Start a new chunk, always with a literal
+        d.len = 0;
+        d.rep = 0;
+        d.mtok = 0;
+        d.lzero = 0;
+        d.in_match = 1;
+        int x;
+        while( (x = decode_byte(&d)) >= 0 )
+            put_byte(x);
+        d.src = d.end;
+    }
+    lzd_free(&d);
+    return d.pos;
+}
+
+// Decodes interleaved streams, one byte of each stream in turn
+static int decode_streams(const uint8_t *data, int size)
+{
+    struct lzd *d = malloc(sizeof(struct lzd) * num_streams);
+    int total = 0;
+
+    if( size < num_streams * 2 )
+    {
+        fprintf(stderr, "ERROR, short file reading streams header.\n");
+        free(d);
+        return 0;
+    }
+    for(int i = 0; i < num_streams; i++)
+    {
+        int start = data[i * 2] + (data[i * 2 + 1] << 8);
+        int end = size;
+        if( i + 1 < num_streams )
+            end = data[i * 2 + 2] + (data[i * 2 + 3] << 8);
+        if( start > end || end > size )
+        {
+            fprintf(stderr, "ERROR, invalid streams header.\n");
+            while( i-- > 0 )
+                lzd_free(&d[i]);
+            free(d);
+            return 0;
+        }
+        lzd_init(&d[i], data + start, data + end);
+    }
+
+    // Decode in lockstep until the first stream ends
+    for(;;)
+    {
+        for(int i = 0; i < num_streams; i++)
+        {
+            int x = decode_byte(&d[i]);
+            if( x < 0 )
             {
-                x = buf[off & mask];
-                buf[pos & mask] = x;
-                putchar(x);
-                pos++;
-                off++;
+                for(i = 0; i < num_streams; i++)
+                    lzd_free(&d[i]);
+                free(d);
+                return total;
             }
+            put_byte(x);
+            total++;
         }
     }
-    return 0;
+}
+
+// Reads all the data from the file, returns the buffer and the size
+static uint8_t *read_data(FILE *f, int *size)
+{
+    int in_size = 0, in_alloc = 65536;
+    uint8_t *data = malloc(in_alloc);
+    for(;;)
+    {
+        in_size += fread(data + in_size, 1, in_alloc - in_size, f);
+        if( in_size < in_alloc )
+            break;
+        in_alloc *= 2;
+        data = realloc(data, in_alloc);
+    }
+    *size = in_size;
+    return data;
 }
 
 static const char *prog_name;
@@ -134,10 +579,12 @@ static void cmd_error(const char *msg)
 int main(int argc, char **argv)
 {
     int verbose = 0;
+    struct filter filter = { FILTER_NONE, 0 };
+    const char *preset_name = 0;
 
     prog_name = argv[0];
     int opt;
-    while( -1 != (opt = getopt(argc, argv, "hvnxo:l:m:A:")) )
+    while( -1 != (opt = getopt(argc, argv, "hvnxwrtpeo:l:m:A:i:F:B:k:f:P:C:")) )
     {
         switch(opt)
         {
@@ -153,12 +600,49 @@ int main(int argc, char **argv)
             case 'A':
                 offset_rel = strtol(optarg, 0, 0);
                 break;
+            case 'i':
+                num_streams = atoi(optarg);
+                break;
+            case 'F':
+                frame_size = atoi(optarg);
+                break;
+            case 'B':
+                block_size = atoi(optarg);
+                break;
+            case 'k':
+                hot_num = atoi(optarg);
+                break;
+            case 'P':
+                preset_name = optarg;
+                break;
+            case 'C':
+                chunk_size = atoi(optarg);
+                break;
+            case 'f':
+                if( filter_parse(&filter, optarg) )
+                    cmd_error("invalid filter, use delta, transpose:W, bitplane:N or columns:W");
+                break;
             case 'x':
                 exor_offset = 1;
                 break;
             case 'n':
                 zero_offset = 1;
                 break;
+            case 'w':
+                var_offset = 1;
+                break;
+            case 'r':
+                rep_offset = 1;
+                break;
+            case 't':
+                nibble_tokens = 1;
+                break;
+            case 'p':
+                split_streams = 1;
+                break;
+            case 'e':
+                end_marker = 1;
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -173,12 +657,27 @@ int main(int argc, char **argv)
                        "input_file is also omitted, read from standard input.\n"
                        "\n"
                        "Options:\n"
-                       "  -o BITS  Sets match offset bits (default = %d).\n"
+                       "  -o BITS  Sets match offset bits, up to 32 (default = %d).\n"
                        "  -l NUM   Sets max literal run length (default = %d).\n"
                        "  -m NUM   Sets max match run length (default = %d).\n"
                        "  -A ADDR  Decode position relative to address instead of offset.\n"
+                       "  -i NUM   Decode NUM byte-interleaved streams.\n"
+                       "  -F SIZE  Decode frames of SIZE bytes from the previous frame.\n"
+                       "  -B SIZE  Decode blocks of SIZE bytes, options read on each block.\n"
+                       "  -C SIZE  Decode chunks split by content, of SIZE bytes on average.\n"
+                       "  -f NAME  Revert filter after decompression, one of 'delta',\n"
+                       "           'transpose:W', 'bitplane:N' or 'columns:W'.\n"
                        "  -n       Do not omit match offset on zero match length.\n"
                        "  -x       Offsets are inverted.\n"
+                       "  -w       Offsets less than 128 in one byte, others in two.\n"
+                       "  -r       Match counts with top bit set repeat the last offset,\n"
+                       "           limits max match run length to 127.\n"
+                       "  -t       Literal and match counts in one byte of two nibbles.\n"
+                       "  -p       Literal bytes in a separate stream after the counts.\n"
+                       "  -e       Data ends with a marker, a zero literal and zero match count.\n"
+                       "  -k NUM   Matches with one of NUM hot offsets in the count byte,\n"
+                       "           limits max match run length to 127.\n"
+                       "  -P FILE  Use the data in FILE as the initial window.\n"
                        "  -v       Shows compression statistics.\n"
                        "  -h       Shows this help.\n",
                        prog_name, bits_moff, max_llen, max_mlen);
@@ -186,13 +685,57 @@ int main(int argc, char **argv)
         }
     }
 
+    // Repeat and hot offsets use the top bit of the match count
+    if( (rep_offset || hot_num) && max_mlen > 127 )
+        max_mlen = 127;
+    if( hot_num > 0 )
+        hot_mlen = 128 / hot_num;
+
     // Check option values
     if( max_mlen < 1 || max_mlen > 32895 )
         cmd_error("max match run length should be from 1 to 32895");
     if( max_llen < 1 || max_llen > 32895 )
         cmd_error("max literal run length should be from 1 to 32895");
-    if( bits_moff < 0 || bits_moff > 16 )
-        cmd_error("match offset bits should be from 0 to 16");
+    if( num_streams < 1 || num_streams > 255 )
+        cmd_error("number of interleaved streams should be from 1 to 255");
+    if( frame_size < 0 || frame_size > 65536 )
+        cmd_error("frame size should be from 1 to 65536");
+    if( frame_size && num_streams > 1 )
+        cmd_error("frames and interleaved streams can't be used together");
+    if( block_size < 0 || block_size > 65536 )
+        cmd_error("block size should be from 1 to 65536");
+    if( block_size && (frame_size || num_streams > 1 || offset_rel >= 0 || var_offset ||
+                       rep_offset || nibble_tokens) )
+        cmd_error("adaptive blocks can't be used with -F, -i, -A, -w, -r or -t");
+    if( bits_moff < 0 || bits_moff > 32 )
+        cmd_error("match offset bits should be from 0 to 32");
+    if( bits_moff > 16 && frame_size )
+        cmd_error("frames need offsets of up to 16 bits");
+    if( nibble_tokens && rep_offset )
+        cmd_error("repeat offsets can't be used with tokens");
+    if( split_streams && (frame_size || num_streams > 1 || block_size) )
+        cmd_error("split streams can't be used with -F, -i or -B");
+    if( end_marker && (frame_size || num_streams > 1 || block_size) )
+        cmd_error("end marker can't be used with -F, -i or -B");
+    if( preset_name && (frame_size || num_streams > 1 || offset_rel >= 0 || block_size ||
+                        filter.type != FILTER_NONE) )
+        cmd_error("preset window can't be used with -F, -i, -A, -B or -f");
+    if( chunk_size && (chunk_size < 256 || chunk_size > 8192 || (chunk_size & (chunk_size - 1))) )
+        cmd_error("chunk size should be a power of two from 256 to 8192");
+    if( chunk_size && (frame_size || num_streams > 1 || offset_rel >= 0 || block_size ||
+                       split_streams || end_marker || hot_num || preset_name) )
+        cmd_error("chunks can't be used with -F, -i, -A, -B, -p, -e, -k or -P");
+    if( chunk_size && bits_moff > 16 )
+        cmd_error("chunks need offsets of up to 16 bits");
+    if( hot_num < 0 || hot_num > 16 || (hot_num & (hot_num - 1)) )
+        cmd_error("number of hot offsets should be 1, 2, 4, 8 or 16");
+    if( hot_num && (!bits_moff || bits_moff > 16 || rep_offset || nibble_tokens || var_offset ||
+                    offset_rel >= 0 || frame_size || num_streams > 1 || block_size) )
+        cmd_error("hot offsets need 1 to 16 offset bits, without -r, -t, -w, -A, -F, -i or -B");
+    if( rep_offset && (!bits_moff || offset_rel >= 0) )
+        cmd_error("repeat offsets need match offsets, without -A");
+    if( var_offset && (bits_moff <= 8 || bits_moff > 16 || exor_offset || offset_rel >= 0) )
+        cmd_error("variable offsets need from 9 to 16 offset bits, without -x or -A");
     if(bits_moff == 8)
     {
         if(offset_rel > 0xFF)
@@ -203,8 +746,13 @@ int main(int argc, char **argv)
         if( offset_rel > 0xFFFF )
             cmd_error("relative address should be less than 65536");
     }
+    else if(bits_moff > 16)
+    {
+        if( bits_moff < 31 && offset_rel >= (1 << bits_moff) )
+            cmd_error("relative address should be less than the maximum offset");
+    }
     else if(offset_rel >= 0)
-        cmd_error("relative address works only with 8 or 16 bit offsets");
+        cmd_error("relative address works only with 8 bit or 16 to 32 bit offsets");
 
     if( optind < argc-2 )
         cmd_error("too many arguments: one input file and one output file expected");
@@ -223,8 +771,64 @@ int main(int argc, char **argv)
     // Set stdin and stdout as binary files
     set_binary();
 
-    // Now, main decoding - this is extremely simple (by design!)
-    int size = decode();
+    // Read all data
+    int in_size;
+    uint8_t *data = read_data(input_file, &in_size);
+    if( input_file != stdin )
+        fclose(input_file);
+
+    // Read the preset window
+    if( preset_name )
+    {
+        FILE *f = fopen(preset_name, "rb");
+        if( !f )
+        {
+            fprintf(stderr, "%s: can't open preset file '%s': %s\n",
+                    prog_name, preset_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        preset_data = read_data(f, &preset_size);
+        fclose(f);
+    }
+
+    // Open output file if needed
+    FILE *output_file = stdout;
+    if( optind < argc-1 )
+    {
+        output_file = fopen(argv[optind+1], "wb");
+        if( !output_file )
+        {
+            fprintf(stderr, "%s: can't open output file '%s': %s\n",
+                    prog_name, argv[optind+1], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Now, main decoding
+    int size;
+    if( frame_size )
+        size = decode_frames(data, in_size);
+    else if( block_size )
+        size = decode_blocks(data, in_size);
+    else if( chunk_size )
+        size = decode_chunks(data, in_size);
+    else if( num_streams > 1 )
+        size = decode_streams(data, in_size);
+    else
+        size = decode(data, in_size);
+
+    // Revert the filter and write
+    filter_revert(&filter, out_buf, out_len);
+    if( out_len )
+        fwrite(out_buf, out_len, 1, output_file);
+
+    if( output_file != stdout )
+        fclose(output_file);
+    else
+        fflush(stdout);
+    free(data);
+    free(out_buf);
+    free(preset_data);
 
     if(verbose)
         fprintf(stderr, "Output size: %d\n", size);
@@ -12,6 +12,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "filter.h"
 
 #ifdef _WIN32
 #include <io.h>
@@ -28,19 +32,23 @@ void set_binary(void)
 #endif
 
 // Big number, used to signal invalid matches
-#define INFINITE_COST   (INT_MAX/256)
+#define INFINITE_COST   (INT_MAX/4)
+// Maximum input size, so that costs in bits stay below INFINITE_COST
+#define MAX_INPUT_SIZE  (32*1024*1024)
 
 // Statistics
 static int *stat_llen;
 static int *stat_mlen;
 static int *stat_moff;
+static int stat_moff_max;
 
 ///////////////////////////////////////////////////////
 // Bit encoding functions
 struct bf
 {
     int len;
-    uint8_t buf[65536];
+    int size;
+    uint8_t *buf;
     int total;
     FILE *out;
 };
@@ -49,6 +57,11 @@ static void init(struct bf *x)
 {
     x->total = 0;
     x->len = 0;
+    if( !x->buf )
+    {
+        x->size = 65536;
+        x->buf = malloc(x->size);
+    }
 }
 
 static void bflush(struct bf *x)
@@ -62,6 +75,11 @@ static void bflush(struct bf *x)
 
 static void add_byte(struct bf *x, int byte)
 {
+    if( x->len >= x->size )
+    {
+        x->size *= 2;
+        x->buf = realloc(x->buf, x->size);
+    }
     x->buf[x->len] = byte;
     x->len ++;
 }
@@ -94,8 +112,30 @@ static int max_llen = 255;      // Maximum literal length (unlimited in LZ4)
 static int zero_offset = 0;     // Do not write offset on matches of length 0
 static int exor_offset = 0;     // Write inverse of offset
 static int zero_match_cost = 0; // Cost of a zero-length match
+static int frame_size = 0;      // Frame size, matches only from previous frame
+static int num_streams = 1;     // Number of interleaved streams
+static int stride = 0;          // Search offsets multiple of stride first
+static int stride_only = 0;     // Search only offsets multiple of stride
+static int var_offset = 0;      // Offsets of one byte if less than 128, two bytes if not
+static int rep_offset = 0;      // Match count with top bit set repeats last offset
+static int nibble_tokens = 0;   // Literal and match counts in one token byte
+static int block_size = 0;      // Block size, options selected on each block
+static int split_streams = 0;   // Literal bytes in a separate stream
+static int end_marker = 0;      // Write an end of data marker
+static int hot_num = 0;         // Number of hot offsets, coded in the match count
+static int hot_mlen = 0;        // Max match length with a hot offset
+static int hot_off[16];         // Hot offsets, the most used ones
+static int preset_size = 0;     // Size of the preset window before the data
+static int chunk_size = 0;      // Average chunk size, chunks split by content
+static const char *cache_dir;   // Directory to store the compressed chunks or match index
+static const char *prog_name;
+
+// Maximum offset, variable offsets are limited to two bytes as long counts
+#define max_off ((var_offset && bits_moff > 15) ? 32896 : \
+                 (bits_moff > 30) ? INT_MAX : (1<<bits_moff))
 
-#define max_off (1<<bits_moff)  // Maximum offset
+// Number of positions tested in the hash chains, for big windows
+#define MAX_CHAIN       1024
 
 // Struct for LZ optimal parsing
 struct lzop_st {
@@ -104,12 +144,14 @@ struct lzop_st {
     int mbits;      // Number of bits needed to code MATCH from position
     int mlen;       // Match length at position
     int mpos;       // Best match offset at position
+    int loff;       // Offset of first match after LITERAL at position
 };
 
 struct lzop
 {
     const uint8_t *data;// The data to compress
     int size;           // Data size
+    int start;          // Start of data to compress, data before is the window
     struct lzop_st *sp; // State at each position
     int in_literal;     // Inside match during encoding
     int bytes_literal;  // Bytes encoded as literal
@@ -119,36 +161,152 @@ struct lzop
     int num_literal;    // Number of literal blocks
     int num_literal0;   // Number of literal blocks of zero length
     int num_matches;    // Number of match blocks
+    int num_nostride;   // Number of matches with offset not multiple of stride
+    int num_repeat;     // Number of matches with repeated offset
+    int num_hot;        // Number of matches with hot offset
+    int last_off;       // Last match offset during encoding
+    int token_pos;      // Position of the last token in the output
+    int *chain;         // Previous position with same hash, for big windows
+    int64_t *rmq;       // Range minimum table of the last positions, for long matches
+    int rmq_levels;     // Number of levels in the range minimum table
+    int rmq_mask;       // Mask for the positions in each level
+    uint32_t *idx_pos;  // Longest match offset at each position, from the search
+    uint16_t *idx_len;  // Longest match length at each position
+    int idx_valid;      // The longest matches were already searched
+    struct bf *lit;     // Output for the literal bytes
 };
 
+// Checks a match candidate at position i, updating the best match found.
+// Returns 1 if the maximal length is reached.
+static int match_test(const uint8_t *data, int pos, int i, int end, int mxlen,
+                      int *mlen, int *mpos)
+{
+    int ml = get_mlen(data + pos, data + i,
+                      frame_size ? -max(-mxlen, i - end) : mxlen);
+    if( ml > *mlen )
+    {
+        *mlen = ml;
+        *mpos = pos - i;
+        if( ml >= mxlen )
+            return 1;
+    }
+    return 0;
+}
+
 // Returns maximal match length (and match position) at pos.
-static int match(const uint8_t *data, int pos, int size, int *mpos)
+static int match(const uint8_t *data, int pos, int size, int start, int *mpos)
 {
     int mxlen = -max(-max_mlen, pos - size);
     int mlen = 0;
-    for(int i=max(pos-max_off,0); i<pos; i++)
+    // On frame mode, match only from the previous frame
+    int end = frame_size ? start : pos;
+    int first = max(pos-max_off,0);
+    if( !stride && !frame_size )
     {
-        int ml = get_mlen(data + pos, data + i, mxlen);
-        if( ml > mlen )
+        // Search all the window, this is the slowest part of the compressor
+        for(int i=first; i<pos; i++)
         {
-            mlen = ml;
-            *mpos = pos - i;
-            if( mlen >= mxlen )
+            int ml = get_mlen(data + pos, data + i, mxlen);
+            if( ml > mlen )
+            {
+                mlen = ml;
+                *mpos = pos - i;
+                if( mlen >= mxlen )
+                    return mlen;
+            }
+        }
+        return mlen;
+    }
+    if( stride )
+    {
+        // Search offsets multiple of the stride first, on 2D data those are
+        // the most probable matches and we can stop early.
+        for(int i = pos - stride; i >= first; i -= stride)
+            if( i < end && match_test(data, pos, i, end, mxlen, &mlen, mpos) )
                 return mlen;
+        if( stride_only )
+        {
+            // Search only the nearest positions
+            for(int i = max(pos - 16, first); i < end; i++)
+                if( match_test(data, pos, i, end, mxlen, &mlen, mpos) )
+                    return mlen;
+            return mlen;
         }
     }
+    // Search the rest of the window, the offsets multiple of the stride were
+    // already tested
+    for(int i=first; i<end; i++)
+        if( (!stride || (pos - i) % stride) &&
+            match_test(data, pos, i, end, mxlen, &mlen, mpos) )
+            return mlen;
+    return mlen;
+}
+
+// Returns maximal match length (and match position) at pos, searching only
+// the positions with the same hash chain, used with big windows.
+static int match_chain(const uint8_t *data, const int *chain, int pos, int size, int *mpos)
+{
+    int mxlen = -max(-max_mlen, pos - size);
+    int mlen = 0;
+    int first = max(pos-max_off,0);
+    int n = 0;
+    for(int i = chain[pos]; i >= first && n < MAX_CHAIN; i = chain[i], n++)
+        if( match_test(data, pos, i, pos, mxlen, &mlen, mpos) )
+            break;
+    return mlen;
+}
+
+// Returns match length at pos with the given offset.
+static int match_offset(const uint8_t *data, int pos, int size, int start, int off)
+{
+    int mxlen = -max(-max_mlen, pos - size);
+    int mlen = 0, mpos;
+    int end = frame_size ? start : pos;
+    if( off < 1 || off > max_off || pos - off < 0 || pos - off >= end )
+        return 0;
+    match_test(data, pos, pos - off, end, mxlen, &mlen, &mpos);
+    return mlen;
+}
+
+// Returns maximal match length (and match position) at pos, searching only
+// the offsets that are encoded in one byte with variable offsets.
+static int match_near(const uint8_t *data, int pos, int size, int start, int *mpos)
+{
+    int mxlen = -max(-max_mlen, pos - size);
+    int mlen = 0;
+    int end = frame_size ? start : pos;
+    int first = max(pos - 128, 0);
+    // Search nearest first, so ties use the smallest offset
+    for(int i = end - 1; i >= first; i--)
+        if( match_test(data, pos, i, end, mxlen, &mlen, mpos) )
+            return mlen;
     return mlen;
 }
 
+// Returns the cost of writing a count with the given maximum
+static int count_cost(int c, int max)
+{
+    if( max > 255 && c > 127 )
+        return 16; // Two byte length
+    else
+        return 8;
+}
+
+// Returns the cost of the extension of a count in a token nibble
+static int ext_cost(int c, int max)
+{
+    return c < 15 ? 0 : count_cost(c - 15, max - 15);
+}
+
 // Returns the cost of writing this length
 static int mlen_cost(int l)
 {
     if( l > max_mlen )
         return INFINITE_COST; // Infinite cost
-    else if( max_mlen > 255 && l > 127 )
-        return 16; // Two byte length
+    else if( nibble_tokens )
+        return ext_cost(l, max_mlen);
     else
-        return 8;
+        return count_cost(l, max_mlen);
 }
 
 // Returns the cost of writing the match offset
@@ -158,13 +316,41 @@ static int moff_cost(int o)
         return INFINITE_COST;
     if (!bits_moff)
         return 0;
-    else if(bits_moff <= 8)
+    else if(bits_moff <= 8 || (var_offset && o <= 128))
         return 8;
     else
-        return 16;
+        return (bits_moff + 7) / 8 * 8;
 }
 
-// Returns the cost of writing this length
+// Returns the index of the offset in the hot offsets table, -1 if not found
+static int hot_index(int o)
+{
+    for(int i = 0; i < hot_num; i++)
+        if( hot_off[i] == o )
+            return i;
+    return -1;
+}
+
+// Returns the cost of writing a match, short matches with a hot offset are
+// written in the count byte only.
+static int match_cost(int o, int l)
+{
+    if( l <= hot_mlen && hot_index(o) >= 0 )
+        return 8;
+    return moff_cost(o) + mlen_cost(l);
+}
+
+// Returns the bits saved on the next match with offset "next", as it is
+// written as a repeated offset after a match with offset "o".
+static int rep_savings(int next, int o)
+{
+    if( rep_offset && next == o )
+        return moff_cost(o);
+    return 0;
+}
+
+// Returns the cost of writing this length, with tokens this includes the
+// token byte also used by the following match.
 static int llen_cost(int l)
 {
     int bits = 0;
@@ -173,18 +359,23 @@ static int llen_cost(int l)
     while( l > max_llen ) {
         // Encode a match of zero length plus the max length
         bits += 8 + zero_match_cost;
+        if( nibble_tokens )
+            bits += ext_cost(max_llen, max_llen);
         l -= max_llen;
     }
+    if( nibble_tokens )
+        return 8 + bits + ext_cost(l, max_llen);
     // Two byte length
     if( max_llen > 255 && l > 127 )
         bits += 8;
     return 8 + bits;
 }
 
-static void lzop_init(struct lzop *lz, const uint8_t *data, int size)
+static void lzop_init(struct lzop *lz, const uint8_t *data, int size, int start)
 {
     lz->data  = data;
     lz->size  = size;
+    lz->start = start;
     lz->sp    = calloc(sizeof(lz->sp[0]), size + 1);
     lz->in_literal = 0;
     lz->bytes_literal = 0;
@@ -192,13 +383,255 @@ static void lzop_init(struct lzop *lz, const uint8_t *data, int size)
     lz->bits_literal = 0;
     lz->bits_matches = 0;
     lz->num_literal = 0;
+    lz->num_literal0 = 0;
     lz->num_matches = 0;
+    lz->num_nostride = 0;
+    lz->num_repeat = 0;
+    lz->num_hot = 0;
+    lz->last_off = 1;
+    lz->chain = 0;
+    lz->rmq = 0;
+    lz->idx_pos = 0;
+    lz->idx_len = 0;
+    lz->idx_valid = 0;
+    if( bits_moff > 16 )
+    {
+        // Hash chains of the next three bytes at each position
+        int *head = malloc(sizeof(int) * 65536);
+        lz->chain = malloc(sizeof(int) * (size + 1));
+        for(int i = 0; i < 65536; i++)
+            head[i] = -1;
+        for(int i = 0; i < size; i++)
+        {
+            if( i + 3 > size )
+            {
+                lz->chain[i] = -1;
+                continue;
+            }
+            int h = (data[i] << 8 ^ data[i+1] << 4 ^ data[i+2]) & 0xFFFF;
+            lz->chain[i] = head[h];
+            head[h] = i;
+        }
+        free(head);
+    }
     zero_match_cost = mlen_cost(0) + (zero_offset ? moff_cost(1) : 0);
 }
 
+// Returns the key of the position in the range minimum table: the cost of a
+// match ending at the position in the high bits, and the negated position in
+// the low bits, so on ties the minimum selects the longest match.
+static int64_t rmq_key(const struct lzop *lz, int pos)
+{
+    const struct lzop_st *cur = &(lz->sp[pos]);
+    int bits = -max(-cur->lbits, -(cur->mbits + llen_cost(1)));
+    return ((int64_t)bits << 32) | (uint32_t)(INT_MAX - pos);
+}
+
+// Allocates the range minimum table, big enough for the max match length
+static void rmq_init(struct lzop *lz)
+{
+    lz->rmq_levels = 1;
+    while( (1 << lz->rmq_levels) <= max_mlen )
+        lz->rmq_levels++;
+    lz->rmq_mask = (1 << lz->rmq_levels) - 1;
+    lz->rmq = malloc(sizeof(int64_t) * lz->rmq_levels << lz->rmq_levels);
+}
+
+// Adds a position to the range minimum table, the table is filled backwards
+// and level k holds the minimum of the 2^k positions starting at each one.
+static void rmq_insert(struct lzop *lz, int pos)
+{
+    int64_t *t = lz->rmq;
+    int w = lz->rmq_mask + 1;
+    t[pos & lz->rmq_mask] = rmq_key(lz, pos);
+    for(int k = 1; k < lz->rmq_levels; k++)
+    {
+        int64_t m = t[(k - 1) * w + (pos & lz->rmq_mask)];
+        int h = pos + (1 << (k - 1));
+        if( h <= lz->size && t[(k - 1) * w + (h & lz->rmq_mask)] < m )
+            m = t[(k - 1) * w + (h & lz->rmq_mask)];
+        t[k * w + (pos & lz->rmq_mask)] = m;
+    }
+}
+
+// Returns the minimum key of the positions from a to b, inclusive
+static int64_t rmq_query(const struct lzop *lz, int a, int b)
+{
+    const int64_t *t = lz->rmq;
+    int w = lz->rmq_mask + 1;
+    int k = 0;
+    while( (2 << k) <= b - a + 1 )
+        k++;
+    int64_t x = t[k * w + (a & lz->rmq_mask)];
+    int64_t y = t[k * w + ((b - (1 << k) + 1) & lz->rmq_mask)];
+    return x < y ? x : y;
+}
+
+// Checks all match lengths up to ml at the given offset as in
+// lzop_match_lengths, but searching the best length in each range of lengths
+// with the same cost in the range minimum table. The result is the same, as
+// the table prefers the longest length and the match after it on ties.
+static void lzop_match_ranges(struct lzop *lz, int pos, int ml, int mp)
+{
+    struct lzop_st *cur = &(lz->sp[pos]);
+    // The cost of the length only changes after those lengths
+    const int ends[4] = { 14, 127, 142, max_mlen };
+    int l = min_mlen;
+    for(int i = 0; i < 4 && l <= ml; i++)
+    {
+        if( ends[i] < l )
+            continue;
+        int e = -max(-ends[i], -ml);
+        int64_t key = rmq_query(lz, pos + l, pos + e);
+        int len = INT_MAX - (int)(key & 0xFFFFFFFF) - pos;
+        int bits = (int)(key >> 32) + match_cost(mp, len);
+        if( bits <= cur->mbits )
+        {
+            cur->mlen = len;
+            cur->mpos = mp;
+            cur->mbits = bits;
+        }
+        l = e + 1;
+    }
+}
+
+// Checks all match lengths up to ml at the given offset, stores best
+static void lzop_match_lengths(struct lzop *lz, int pos, int ml, int mp)
+{
+    struct lzop_st *cur = &(lz->sp[pos]);
+    if( lz->rmq && ml - min_mlen > 32 )
+    {
+        lzop_match_ranges(lz, pos, ml, mp);
+        return;
+    }
+    for(int l=min_mlen; l <= ml; l++)
+    {
+        struct lzop_st *nxt = &(lz->sp[pos + l]);
+
+        // MATCH after:
+        //   If we land in another MATCH, we need to encode a new literal
+        //   of length 0 there, so adds a byte
+        //   If the next match has the same offset, it is repeated.
+        int mbits = nxt->mbits - rep_savings(nxt->mpos, mp) + llen_cost(1) +
+                    match_cost(mp, l);
+        // LITERAL after
+        int lbits = nxt->lbits - rep_savings(nxt->loff, mp) + match_cost(mp, l);
+
+        // TODO: how to resolve ties mbits/lbits??
+        // The order of te comparisons bellow, or using < instead of <= does
+        // not seem to affect compression.
+        if( lbits <= cur->mbits )
+        {
+            cur->mlen = l;
+            cur->mpos = mp;
+            cur->mbits = lbits;
+        }
+        if( mbits <= cur->mbits )
+        {
+            cur->mlen = l;
+            cur->mpos = mp;
+            cur->mbits = mbits;
+        }
+    }
+}
+
+// FNV-1a hash of the data, continuing from the given hash
+static uint64_t fnv_hash(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for(size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+// Returns the name of the match index file in the cache directory, from a
+// hash of the data and of the options that change the match search.
+static char *index_name(const struct lzop *lz)
+{
+    const int opts[] = { bits_moff, var_offset, max_mlen, stride, stride_only, frame_size,
+                         lz->start, lz->size };
+    uint64_t h = fnv_hash(0xCBF29CE484222325ULL, opts, sizeof(opts));
+    h = fnv_hash(h, lz->data, lz->size);
+    char *name = malloc(strlen(cache_dir) + 32);
+    sprintf(name, "%s/%016llx.lz8i", cache_dir, (unsigned long long)h);
+    return name;
+}
+
+// Returns the hash of the match index, stored in the index file
+static uint64_t index_hash(const uint32_t *mpos, const uint16_t *mlen, int n)
+{
+    uint64_t h = fnv_hash(0xCBF29CE484222325ULL, mpos, sizeof(mpos[0]) * n);
+    return fnv_hash(h, mlen, sizeof(mlen[0]) * n);
+}
+
+// Reads the match index: a header with the number of positions and the hash
+// of the index, followed by the match positions and the match lengths of
+// each position. Returns 1 if found and not corrupted.
+static int index_load(const char *name, uint32_t *mpos, uint16_t *mlen, int n)
+{
+    uint64_t hdr[2];
+    FILE *f = fopen(name, "rb");
+    if( !f )
+        return 0;
+    int ok = fread(hdr, sizeof(hdr), 1, f) == 1 && hdr[0] == (uint64_t)n &&
+             fread(mpos, sizeof(mpos[0]), n, f) == (size_t)n &&
+             fread(mlen, sizeof(mlen[0]), n, f) == (size_t)n && fgetc(f) == EOF &&
+             hdr[1] == index_hash(mpos, mlen, n);
+    fclose(f);
+    return ok;
+}
+
+// Writes the match index, in the same format as read above. It is written
+// to a temporary name and renamed, so an interrupted write never leaves a
+// partial file with the final name.
+static void index_save(const char *name, const uint32_t *mpos, const uint16_t *mlen, int n)
+{
+    uint64_t hdr[2] = { n, index_hash(mpos, mlen, n) };
+    char *tname = malloc(strlen(name) + 8);
+    sprintf(tname, "%s.tmp", name);
+    FILE *f = fopen(tname, "wb");
+    if( !f )
+    {
+        fprintf(stderr, "%s: can't write index file '%s': %s\n",
+                prog_name, tname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+             fwrite(mpos, sizeof(mpos[0]), n, f) == (size_t)n &&
+             fwrite(mlen, sizeof(mlen[0]), n, f) == (size_t)n;
+    if( fclose(f) || !ok || rename(tname, name) )
+        remove(tname);
+    free(tname);
+}
+
+// Allocates the match index, so the match search is done only once on
+// multiple parses. With a cache directory, reads it from the cache if found.
+static void lzop_index_init(struct lzop *lz)
+{
+    int n = lz->size - lz->start;
+    lz->idx_pos = malloc(sizeof(lz->idx_pos[0]) * n);
+    lz->idx_len = malloc(sizeof(lz->idx_len[0]) * n);
+    lz->idx_valid = 0;
+    if( cache_dir && !chunk_size )
+    {
+        char *name = index_name(lz);
+        lz->idx_valid = index_load(name, lz->idx_pos, lz->idx_len, n);
+        free(name);
+    }
+}
+
+static void lzop_index_free(struct lzop *lz)
+{
+    free(lz->idx_pos);
+    free(lz->idx_len);
+    lz->idx_pos = 0;
+    lz->idx_len = 0;
+    lz->idx_valid = 0;
+}
+
 static void lzop_backfill(struct lzop *lz)
 {
-    if(!lz->size)
+    if(lz->size <= lz->start)
         return;
 
     // Initialize the last byte
@@ -210,11 +643,27 @@ static void lzop_backfill(struct lzop *lz)
         cur->lbits = 0;
         cur->mlen  = 0;
         cur->mpos  = 0;
+        cur->loff  = 0;
         cur->mbits = INFINITE_COST;
     }
 
+    // With long matches, search the match lengths in a range minimum table,
+    // the cost of each length does not depend on the offset without repeated
+    // or hot offsets.
+    if( max_mlen > 255 && !rep_offset && !hot_num )
+    {
+        rmq_init(lz);
+        rmq_insert(lz, lz->size);
+    }
+
+    // With a cache directory, the longest match at each position is read
+    // from the match index, or stored there after the search.
+    int own_index = !lz->idx_len && cache_dir && !chunk_size;
+    if( own_index )
+        lzop_index_init(lz);
+
     // Go backwards in file storing best parsing
-    for(int pos = lz->size - 1; pos>=0; pos--)
+    for(int pos = lz->size - 1; pos>=lz->start; pos--)
     {
         // Get best match at this position
         int mp = 0;
@@ -238,12 +687,15 @@ static void lzop_backfill(struct lzop *lz)
             {
                 cur->lbits = lbits;
                 cur->llen = nxt->llen + i;
+                cur->loff = nxt->loff;
             }
         }
 
         //  MATCH after N bytes of literal,
         //  encode 1 byte of literal plus the full match, search up to max
-        //  "available" literal length
+        //  "available" literal length. Longer literals are split, so this
+        //  is limited to the max literal length.
+        ml = -max(-ml, -max_llen - 1);
         for(int i = 1; i <= ml - 1; i++)
         {
             struct lzop_st *nxt = &(lz->sp[pos+i]);
@@ -252,48 +704,98 @@ static void lzop_backfill(struct lzop *lz)
             {
                 cur->llen = i;
                 cur->lbits = mbits;
+                cur->loff = nxt->mpos;
             }
         }
 
-        // Check all posible match lengths, store best
-        ml = match(lz->data , pos, lz->size, &mp);
-        int bestm = INFINITE_COST;
+        // Check all posible match lengths, store best. An entry of the index
+        // that is not a valid match at this position is searched again.
+        ml = -1;
+        if( lz->idx_valid )
+        {
+            int il = lz->idx_len[pos - lz->start];
+            mp = lz->idx_pos[pos - lz->start];
+            if( !il )
+                ml = mp = 0;
+            else if( mp >= 1 && mp <= -max(-max_off, -pos) && il <= lz->size - pos &&
+                     (!frame_size || mp > pos - lz->start) &&
+                     get_mlen(lz->data + pos, lz->data + pos - mp, il) == il )
+                // The index can be from a search with a bigger max length
+                ml = -max(-il, -max_mlen);
+        }
+        if( ml < 0 )
+        {
+            mp = 0;
+            if( lz->chain )
+                ml = match_chain(lz->data, lz->chain, pos, lz->size, &mp);
+            else
+                ml = match(lz->data , pos, lz->size, lz->start, &mp);
+            if( lz->idx_len )
+            {
+                lz->idx_len[pos - lz->start] = ml;
+                lz->idx_pos[pos - lz->start] = mp;
+            }
+        }
         cur->mbits = INFINITE_COST;
         cur->mpos = mp;
-        for(int l=min_mlen; l <= ml; l++)
-        {
-            struct lzop_st *nxt = &(lz->sp[pos + l]);
+        lzop_match_lengths(lz, pos, ml, mp);
 
-            // MATCH after:
-            //   If we land in another MATCH, we need to encode a new literal
-            //   of length 0 there, so adds a byte
-            int mbits = nxt->mbits + llen_cost(1) + moff_cost(mp) + mlen_cost(l);
-            // LITERAL after
-            int lbits = nxt->lbits + moff_cost(mp) + mlen_cost(l);
+        // With variable offsets, a shorter match with a near offset can
+        // be cheaper than the longest match.
+        if( var_offset && mp > 128 )
+        {
+            ml = match_near(lz->data, pos, lz->size, lz->start, &mp);
+            lzop_match_lengths(lz, pos, ml, mp);
+        }
 
-            // TODO: how to resolve ties mbits/lbits??
-            // The order of te comparisons bellow, or using < instead of <= does
-            // not seem to affect compression.
-            if( lbits <= bestm )
-            {
-                bestm = lbits;
-                cur->mlen = l;
-                cur->mbits = bestm;
-            }
-            if( mbits <= bestm )
+        // With repeat offsets, a match with the same offset as the following
+        // matches can be cheaper than the longest match.
+        if( rep_offset )
+        {
+            int offs[3] = { cur->loff, lz->sp[pos+1].loff, lz->sp[pos+1].mpos };
+            for(int i = 0; i < 3; i++)
             {
-                bestm = mbits;
-                cur->mlen = l;
-                cur->mbits = bestm;
+                if( offs[i] == mp || (i && offs[i] == offs[i-1]) )
+                    continue;
+                ml = match_offset(lz->data, pos, lz->size, lz->start, offs[i]);
+                lzop_match_lengths(lz, pos, ml, offs[i]);
             }
         }
+
+        // With hot offsets, a short match at a hot offset can be cheaper
+        // than the longest match.
+        for(int i = 0; i < hot_num; i++)
+        {
+            if( hot_off[i] == mp )
+                continue;
+            ml = match_offset(lz->data, pos, lz->size, lz->start, hot_off[i]);
+            lzop_match_lengths(lz, pos, ml, hot_off[i]);
+        }
+
+        if( lz->rmq )
+            rmq_insert(lz, pos);
+    }
+    free(lz->rmq);
+    lz->rmq = 0;
+    if( lz->idx_len && !lz->idx_valid )
+    {
+        if( cache_dir && !chunk_size )
+        {
+            char *name = index_name(lz);
+            index_save(name, lz->idx_pos, lz->idx_len, lz->size - lz->start);
+            free(name);
+        }
+        lz->idx_valid = 1;
     }
+    if( own_index )
+        lzop_index_free(lz);
 }
 
 static void debug_encode(struct lzop *lz, int sz)
 {
     int in_literal = 0;
-    int pos = 0;
+    int last_off = 1;
+    int pos = lz->start;
 #if 0
     for(int i = 0; i < sz; i++)
     {
@@ -309,7 +811,9 @@ static void debug_encode(struct lzop *lz, int sz)
         int cm = cur->mbits >= INFINITE_COST ? -1 : cur->mbits;
         fprintf(stderr, "[%04X]: (%6d:%6d) ", pos, cur->lbits, cm);
         int extra_cost = in_literal ? zero_match_cost : 0;
-        if( cur->lbits + extra_cost <= cur->mbits )
+        int lbits = cur->lbits - rep_savings(cur->loff, last_off);
+        int mbits = cur->mbits - rep_savings(cur->mpos, last_off);
+        if( lbits + extra_cost <= mbits )
         {
             int len = cur->llen;
             int cost = llen_cost(len) + len * 8;
@@ -321,7 +825,7 @@ static void debug_encode(struct lzop *lz, int sz)
             }
             fprintf(stderr, "L %3d %4d | %6d -%5d ->%6d\n",
                     len, llen_cost(len) / 8 + len,
-                    cur->lbits, cost, cur->lbits - cost);
+                    lbits, cost, lbits - cost);
             pos += len;
             in_literal = 1;
         }
@@ -329,54 +833,85 @@ static void debug_encode(struct lzop *lz, int sz)
         {
             int mpos = cur->mpos;
             int len = cur->mlen;
-            int cost = mlen_cost(len) + moff_cost(mpos);
+            int mcost = match_cost(mpos, len) - rep_savings(mpos, last_off);
+            int cost = mcost;
             if(!in_literal)
             {
                 fprintf(stderr, "L0 (%4d)\n                        ", llen_cost(0));
                 cost = cost + llen_cost(0);
             }
             fprintf(stderr, "M %3d %4d | %6d -%5d ->%6d\n",
-                    len, (mlen_cost(len) + moff_cost(mpos))/8,
-                    cur->mbits, cost, cur->mbits - cost);
+                    len, mcost/8, mbits, cost, mbits - cost);
+            last_off = mpos;
             pos += len;
             in_literal = 0;
         }
     }
 }
 
-static void code_match(struct bf *b, struct lzop *lz, int len, int off)
+// Writes a count, in two bytes if bigger than 127 and the maximum is bigger
+// than 255.
+static void code_count(struct bf *b, int c, int max, int *bits)
 {
-    // Keep statistics as a match if len > 0, literal otherwise
-    int *bits = len ? &lz->bits_matches : &lz->bits_literal;
-
-    if(len > 127 && max_mlen > 255)
+    if(c > 127 && max > 255)
     {
-        add_byte(b, (0x80 | len) & 0xFF);
-        add_byte(b, (len >> 7) - 1);
+        add_byte(b, (0x80 | c) & 0xFF);
+        add_byte(b, (c >> 7) - 1);
         *bits += 16;
     }
     else
     {
-        add_byte(b, len & 0xFF);
+        add_byte(b, c & 0xFF);
         *bits += 8;
     }
-    if(len || zero_offset)
+}
+
+// Writes a new token with the literal count, the match count is added later
+static void code_token(struct bf *b, struct lzop *lz, int len, int *bits)
+{
+    lz->token_pos = b->len;
+    add_byte(b, (len < 15 ? len : 15) << 4);
+    *bits += 8;
+    if( len >= 15 )
+        code_count(b, len - 15, max_llen - 15, bits);
+}
+
+// Writes a match offset
+static void code_offset(struct bf *b, unsigned off, int *bits)
+{
+    if( exor_offset )
+        off = off ^ (unsigned)((1ULL << bits_moff) - 1);
+    if( var_offset )
+        code_count(b, off, 65535, bits); // Same encoding as long counts
+    else
     {
-        if( exor_offset )
-            off = off ^ (max_off - 1);
-        if( bits_moff )
-        {
-            add_byte(b, off & 0xFF );
-            *bits += 8;
-        }
-        if( bits_moff > 8 )
+        // Low byte first
+        for(int i = 0; i < bits_moff; i += 8)
         {
-            add_byte(b, off >> 8 );
+            add_byte(b, (off >> i) & 0xFF);
             *bits += 8;
         }
     }
 }
 
+static void code_match(struct bf *b, struct lzop *lz, int len, unsigned off)
+{
+    // Keep statistics as a match if len > 0, literal otherwise
+    int *bits = len ? &lz->bits_matches : &lz->bits_literal;
+
+    if( nibble_tokens )
+    {
+        // Match count in the low nibble of the last token
+        b->buf[lz->token_pos] |= len < 15 ? len : 15;
+        if( len >= 15 )
+            code_count(b, len - 15, max_mlen - 15, bits);
+    }
+    else
+        code_count(b, len, max_mlen, bits);
+    if(len || zero_offset)
+        code_offset(b, off, bits);
+}
+
 static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int offset_rel)
 {
     if( pos <= lpos )
@@ -384,7 +919,7 @@ static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int off
         // We are skipping, output byte if the skip is a literal
         if( lz->in_literal )
         {
-            add_byte(b, lz->data[pos]);
+            add_byte(lz->lit, lz->data[pos]);
             lz->bytes_literal ++;
         }
         else
@@ -395,7 +930,9 @@ static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int off
     // Encode best from filled table
     struct lzop_st *cur = &(lz->sp[pos]);
     int extra_cost = lz->in_literal ? zero_match_cost : 0;
-    if( cur->lbits + extra_cost <= cur->mbits )
+    int lbits = cur->lbits - rep_savings(cur->loff, lz->last_off);
+    int mbits = cur->mbits - rep_savings(cur->mpos, lz->last_off);
+    if( lbits + extra_cost <= mbits )
     {
         // Literal just encode the byte
         int len = cur->llen;
@@ -404,24 +941,18 @@ static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int off
         // Already on literal - encode a zero length match to terminate
         if( lz->in_literal )
         {
-            code_match(b, lz, 0, 0);
+            // With repeat offsets, keep the last offset
+            code_match(b, lz, 0, rep_offset ? lz->last_off - 1 : 0);
             lz->num_matches++;
         }
         // Encode new literal count
-        if( max_llen > 255 && len > 127 )
-        {
-            add_byte(b, (0x80 | len) & 0xFF);
-            add_byte(b, (len >> 7) - 1);
-            lz->bits_literal += 16;
-        }
+        if( nibble_tokens )
+            code_token(b, lz, len, &lz->bits_literal);
         else
-        {
-            add_byte(b, len & 0xFF);
-            lz->bits_literal += 8;
-        }
+            code_count(b, len, max_llen, &lz->bits_literal);
         stat_llen[len]++;
         // And first literal
-        add_byte(b, lz->data[pos]);
+        add_byte(lz->lit, lz->data[pos]);
         lz->bytes_literal ++;
         lz->in_literal = 1;
         lz->num_literal ++;
@@ -431,21 +962,44 @@ static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int off
     {
         int mpos = cur->mpos;
         int mlen = cur->mlen;
+        unsigned off;
         stat_mlen[mlen]++;
         stat_moff[mpos]++;
+        if( stride && mpos % stride )
+            lz->num_nostride ++;
         if( offset_rel < 0 )
-            mpos = (mpos - 1) & 0xFFFF;
+            off = mpos - 1;
+        else if( bits_moff > 16 )
+            off = ((unsigned)pos + offset_rel - mpos) & (unsigned)((1ULL << bits_moff) - 1);
         else
-            mpos = (pos + offset_rel - mpos) & 0xFFFF;
+            off = (pos + offset_rel - mpos) & 0xFFFF;
         if( !lz->in_literal )
         {
             // Already on match - encode a zero length literal
-            add_byte(b, 0);
+            if( nibble_tokens )
+                code_token(b, lz, 0, &lz->bits_matches);
+            else
+                code_count(b, 0, max_llen, &lz->bits_matches);
             stat_llen[0]++;
-            lz->bits_matches += 8;
             lz->num_literal0 ++;
         }
-        code_match(b, lz, mlen, mpos);
+        if( mlen <= hot_mlen && hot_index(cur->mpos) >= 0 )
+        {
+            // Hot offset, write the offset index and count in one byte
+            add_byte(b, 0x80 | hot_index(cur->mpos) * hot_mlen | (mlen - 1));
+            lz->bits_matches += 8;
+            lz->num_hot ++;
+        }
+        else if( rep_offset && cur->mpos == lz->last_off )
+        {
+            // Same offset as last match, write only the count
+            add_byte(b, 0x80 | mlen);
+            lz->bits_matches += 8;
+            lz->num_repeat ++;
+        }
+        else
+            code_match(b, lz, mlen, off);
+        lz->last_off = cur->mpos;
         lz->bytes_matches ++;
         lz->in_literal = 0;
         lz->num_matches ++;
@@ -453,7 +1007,154 @@ static int lzop_encode(struct bf *b, struct lzop *lz, int pos, int lpos, int off
     }
 }
 
-static const char *prog_name;
+// Adds the statistics of one compressed stream to the total
+static void lzop_add_stats(struct lzop *t, const struct lzop *lz)
+{
+    t->size          += lz->size - lz->start;
+    t->bytes_literal += lz->bytes_literal;
+    t->bytes_matches += lz->bytes_matches;
+    t->bits_literal  += lz->bits_literal;
+    t->bits_matches  += lz->bits_matches;
+    t->num_literal   += lz->num_literal;
+    t->num_literal0  += lz->num_literal0;
+    t->num_matches   += lz->num_matches;
+    t->num_nostride  += lz->num_nostride;
+    t->num_repeat    += lz->num_repeat;
+    t->num_hot       += lz->num_hot;
+}
+
+// Returns the estimated size in bits of the compressed stream
+static int lzop_bits(const struct lzop *lz)
+{
+    const struct lzop_st *st = &(lz->sp[lz->start]);
+    if( lz->size <= lz->start )
+        return 0;
+    // Repeat offsets start with an offset of 1, and starting with a match
+    // needs a literal of length 0 first.
+    int lbits = st->lbits - rep_savings(st->loff, 1);
+    int mbits = st->mbits - rep_savings(st->mpos, 1) + 8;
+    return mbits < lbits ? mbits : lbits;
+}
+
+// Selects the offsets used by most matches in the parsing as hot offsets
+static void lzop_hot_select(struct lzop *lz)
+{
+    int *count = calloc(sizeof(int), max_off + 1);
+    int in_literal = 0;
+    for(int pos = lz->start; pos < lz->size; )
+    {
+        struct lzop_st *cur = &(lz->sp[pos]);
+        int extra_cost = in_literal ? zero_match_cost : 0;
+        if( cur->lbits + extra_cost <= cur->mbits )
+        {
+            pos += -max(-cur->llen, -max_llen);
+            in_literal = 1;
+        }
+        else
+        {
+            count[cur->mpos]++;
+            pos += cur->mlen;
+            in_literal = 0;
+        }
+    }
+    for(int i = 0; i < hot_num; i++)
+    {
+        int best = 0;
+        for(int o = 1; o <= max_off; o++)
+            if( count[o] > count[best] )
+                best = o;
+        hot_off[i] = best;
+        count[best] = 0;
+    }
+    free(count);
+}
+
+// Writes the parsed stream, appending the result to the bit buffer, and the
+// literal bytes to the "lit" buffer of the parser.
+static void lzop_write(struct bf *b, struct lzop *lz, int offset_rel, int print_debug)
+{
+    int lpos = -1;
+
+    // Write encode walk:
+    if(print_debug)
+        debug_encode(lz, lz->size);
+
+    for(int pos = lz->start; pos < lz->size; pos++)
+        lpos = lzop_encode(b, lz, pos, lpos, offset_rel);
+
+    if( end_marker )
+    {
+        // End marker, a zero length literal followed by a zero length match
+        // without offset; after a literal, terminate it with a normal zero
+        // length match first.
+        if( lz->in_literal )
+        {
+            code_match(b, lz, 0, rep_offset ? lz->last_off - 1 : 0);
+            lz->num_matches++;
+        }
+        add_byte(b, 0);
+        lz->bits_matches += 8;
+        if( !nibble_tokens )
+        {
+            add_byte(b, 0);
+            lz->bits_matches += 8;
+        }
+    }
+}
+
+// Compress one full stream, appending the result to the bit buffer, and the
+// literal bytes to the "lit" buffer. The data before "start" is used only as
+// the initial window.
+static void compress(struct bf *b, struct lzop *lz, const uint8_t *data, int sz,
+                     int start, int offset_rel, int print_debug, struct bf *lit)
+{
+    lzop_init(lz, data, sz, start);
+    lz->lit = lit;
+    memset(hot_off, 0, sizeof(hot_off));
+    // With hot offsets the data is parsed many times, search the longest
+    // matches only on the first parse
+    if( hot_num )
+        lzop_index_init(lz);
+    lzop_backfill(lz);
+    if( hot_num )
+    {
+        // Select the hot offsets from the parsing, and parse again; repeat
+        // a few times, as the new parsing uses different offsets.
+        int best = INT_MAX, best_i = 0, best_off[16];
+        for(int i = 0; i < 4; i++)
+        {
+            lzop_hot_select(lz);
+            lzop_backfill(lz);
+            if( lzop_bits(lz) < best )
+            {
+                best = lzop_bits(lz);
+                best_i = i;
+                memcpy(best_off, hot_off, sizeof(hot_off));
+            }
+        }
+        // Parse again with the best, if it was not the last one
+        if( best_i != 3 )
+        {
+            memcpy(hot_off, best_off, sizeof(hot_off));
+            lzop_backfill(lz);
+        }
+        lzop_index_free(lz);
+        // Write the table of hot offsets
+        for(int i = 0; i < hot_num; i++)
+            code_offset(b, hot_off[i] ? hot_off[i] - 1 : 0, &lz->bits_matches);
+    }
+    free(lz->chain);
+    lzop_write(b, lz, offset_rel, print_debug);
+}
+
+// Returns the size in bits of the end marker
+static int lzop_end_bits(const struct lzop *lz)
+{
+    if( !end_marker )
+        return 0;
+    return (nibble_tokens ? 8 : 16) + (lz->in_literal ? zero_match_cost : 0);
+}
+
 static void cmd_error(const char *msg)
 {
     fprintf(stderr,"%s: error, %s\n"
@@ -461,19 +1162,985 @@ static void cmd_error(const char *msg)
     exit(1);
 }
 
-///////////////////////////////////////////////////////
-int main(int argc, char **argv)
+// Reads all the data from the file, returns the buffer and the size
+static uint8_t *read_data(FILE *f, int *size)
 {
-    struct bf b;
-    uint8_t *data;
-    int lpos;
-    int show_stats = 1;
-    int offset_rel = -1;
+    int sz = 0, data_size = 128*1024;
+    uint8_t *data = malloc(data_size);
+    for(;;)
+    {
+        sz += fread(data + sz, 1, data_size - sz, f);
+        if( sz < data_size )
+            break;
+        if( data_size >= MAX_INPUT_SIZE )
+            cmd_error("input file too big, maximum is 32MB");
+        data_size *= 2;
+        data = realloc(data, data_size);
+    }
+    *size = sz;
+    return data;
+}
+
+// Random values for the rolling hash of the chunks
+static uint32_t gear_table[256];
+
+// Returns the length of the chunk starting at pos: the chunk ends when the
+// rolling hash of the last 32 bytes has the top bits zero, with a length
+// between a quarter and four times the average chunk size.
+static int chunk_length(const uint8_t *data, int pos, int sz)
+{
+    int bits = 0;
+    while( (1 << bits) < chunk_size )
+        bits++;
+    if( !gear_table[0] )
+    {
+        uint32_t x = 0x12345678;
+        for(int i = 0; i < 256; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            gear_table[i] = x;
+        }
+    }
+    uint32_t h = 0;
+    int max_len = chunk_size * 4;
+    if( max_len > sz - pos )
+        max_len = sz - pos;
+    for(int len = 1; len <= max_len; len++)
+    {
+        h = (h << 1) + gear_table[data[pos + len - 1]];
+        if( len >= chunk_size / 4 && !(h >> (32 - bits)) )
+            return len;
+    }
+    return max_len;
+}
+
+// Compress the data in chunks split by content, each one with the previous
+// window of data and a header with the compressed size. With a cache
+// directory, the compressed chunks are stored there and reused when the
+// chunk, the window and the options are the same. Each cache file starts with
+// the chunk size, the compressed size and a hash of the compressed bytes, so
+// that truncated or corrupted files are not used.
+// Returns the estimated size in bits.
+static int compress_chunks(struct bf *b, struct lzop *total, const uint8_t *data, int sz,
+                           int print_debug, int show_stats)
+{
+    const int opts[] = { bits_moff, min_mlen, max_mlen, max_llen, zero_offset, exor_offset,
+                         var_offset, rep_offset, nibble_tokens, stride, stride_only };
+    int bits = 0, num = 0, cached = 0;
+    for(int pos = 0, csz; pos < sz; pos += csz, num++)
+    {
+        csz = chunk_length(data, pos, sz);
+        int wstart = max(pos - max_off, 0);
+        int hpos = b->len, from_cache = 0;
+        char *cname = 0;
+        add_byte(b, 0);
+        add_byte(b, 0);
+        bits += 16;
+
+        if( cache_dir )
+        {
+            uint64_t h = 0xCBF29CE484222325ULL;
+            int lens[2] = { pos - wstart, csz };
+            h = fnv_hash(h, opts, sizeof(opts));
+            h = fnv_hash(h, lens, sizeof(lens));
+            h = fnv_hash(h, data + wstart, pos + csz - wstart);
+            cname = malloc(strlen(cache_dir) + 32);
+            sprintf(cname, "%s/%016llx.lz8c", cache_dir, (unsigned long long)h);
+            FILE *f = fopen(cname, "rb");
+            if( f )
+            {
+                int n;
+                uint64_t hdr[3] = { 0, 0, 0 };
+                uint8_t *c = read_data(f, &n);
+                fclose(f);
+                if( n >= (int)sizeof(hdr) )
+                    memcpy(hdr, c, sizeof(hdr));
+                if( hdr[0] == (uint64_t)csz && hdr[1] == n - sizeof(hdr) &&
+                    hdr[2] == fnv_hash(0xCBF29CE484222325ULL, c + sizeof(hdr), hdr[1]) )
+                {
+                    for(int i = sizeof(hdr); i < n; i++)
+                        add_byte(b, c[i]);
+                    bits += (n - (int)sizeof(hdr)) * 8;
+                    from_cache = 1;
+                    cached++;
+                }
+                free(c);
+            }
+        }
+
+        if( !from_cache )
+        {
+            struct lzop lz;
+            int start = b->len;
+            compress(b, &lz, data + wstart, pos + csz - wstart, pos - wstart, -1, print_debug, b);
+            lzop_add_stats(total, &lz);
+            bits += lzop_bits(&lz);
+            free(lz.sp);
+            if( cname )
+            {
+                // Write to a temporary name and rename, so that an interrupted
+                // write never leaves a partial file with the final name.
+                char *tname = malloc(strlen(cname) + 8);
+                uint64_t hdr[3] = { csz, b->len - start,
+                                    fnv_hash(0xCBF29CE484222325ULL, b->buf + start, b->len - start) };
+                sprintf(tname, "%s.tmp", cname);
+                FILE *f = fopen(tname, "wb");
+                if( !f )
+                {
+                    fprintf(stderr, "%s: can't write cache file '%s': %s\n",
+                            prog_name, tname, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+                         fwrite(b->buf + start, 1, b->len - start, f) == (size_t)(b->len - start);
+                if( fclose(f) || !ok || rename(tname, cname) )
+                    remove(tname);
+                free(tname);
+            }
+        }
+        free(cname);
+
+        int clen = b->len - hpos - 2;
+        if( clen > 0xFFFF )
+            cmd_error("compressed chunk too big for the 16 bit header");
+        b->buf[hpos] = clen & 0xFF;
+        b->buf[hpos + 1] = clen >> 8;
+        if( show_stats > 1 )
+            fprintf(stderr, " Chunk %d: %5d / %d bytes%s\n",
+                    num, clen, csz, from_cache ? ", from cache" : "");
+    }
+    if( show_stats )
+        fprintf(stderr, " Chunks: %d, %d from cache\n", num, cached);
+    return bits;
+}
+
+// Sets the options of the block header, offset bytes and long counts
+static void block_options(int opt)
+{
+    bits_moff = (opt >> 1) * 8;
+    max_llen = max_mlen = (opt & 1) ? 32895 : 255;
+    zero_match_cost = mlen_cost(0) + (zero_offset ? moff_cost(1) : 0);
+}
+
+// Compress the data in groups of blocks, each group with the offset bits
+// and max lengths giving the smallest estimated size on the first block,
+// written in a header byte with the number of offset bytes, the number of
+// blocks after the first in bits 2 to 6, and the top bit set for long
+// counts. A block continues the group when that is not bigger than a new
+// header plus the best options for the block, so the parsing is not
+// interrupted. Returns the estimated size in bits.
+static int compress_blocks(struct bf *b, struct lzop *total, const uint8_t *data, int sz,
+                           int offset_rel, int print_debug, int show_stats)
+{
+    struct lzop glz;    // Parsing of the first block of the group
+    int bits = 0, gpos = 0, gnum = 0, gopt = 0;
+    for(int pos = 0; ; pos += block_size)
+    {
+        // Parse the block with each option: offset bytes 0 to 2 times two,
+        // plus one for long counts. The search of the longest matches is
+        // the same with both max lengths, so it is done only once.
+        struct lzop lz[6];
+        int cost[6], best = 0;
+        if( pos < sz )
+        {
+            int bsz = -max(-block_size, pos - sz);
+            // Window of the previous 64k bytes
+            int wstart = max(pos - 65536, 0);
+            for(int opt = 5; opt >= 0; opt--)
+            {
+                block_options(opt);
+                lzop_init(&lz[opt], data + wstart, pos + bsz - wstart, pos - wstart);
+                if( opt & 1 )
+                    lzop_index_init(&lz[opt]);
+                else
+                {
+                    lz[opt].idx_pos = lz[opt + 1].idx_pos;
+                    lz[opt].idx_len = lz[opt + 1].idx_len;
+                    lz[opt].idx_valid = 1;
+                }
+                lzop_backfill(&lz[opt]);
+                cost[opt] = lzop_bits(&lz[opt]);
+                if( !(opt & 1) )
+                    lzop_index_free(&lz[opt + 1]);
+                if( opt != 5 && cost[opt] <= cost[best] )
+                    best = opt;
+                else if( opt == 5 )
+                    best = opt;
+            }
+        }
+
+        // Continue the current group if not bigger than a new one
+        if( pos < sz && gnum && gnum < 32 && cost[gopt] <= cost[best] + 8 )
+        {
+            for(int opt = 0; opt < 6; opt++)
+                free(lz[opt].sp);
+            gnum++;
+            continue;
+        }
+
+        // Write the current group, reusing the parsing of a single block
+        if( gnum )
+        {
+            int gend = -max(-(gpos + gnum * block_size), -sz);
+            int wstart = max(gpos - 65536, 0);
+            int start = b->len;
+            block_options(gopt);
+            add_byte(b, (gopt >> 1) | (gnum - 1) << 2 | ((gopt & 1) ? 0x80 : 0));
+            bits += 8;
+            if( gnum == 1 )
+            {
+                glz.lit = b;
+                lzop_write(b, &glz, offset_rel, print_debug);
+            }
+            else
+            {
+                free(glz.sp);
+                compress(b, &glz, data + wstart, gend - wstart, gpos - wstart,
+                         offset_rel, print_debug, b);
+            }
+            lzop_add_stats(total, &glz);
+            bits += lzop_bits(&glz);
+            free(glz.sp);
+            if( show_stats > 1 )
+                fprintf(stderr, " Blocks %d-%d: -o %-2d %-17s %5d / %d bytes\n",
+                        gpos / block_size, gpos / block_size + gnum - 1, bits_moff,
+                        (gopt & 1) ? "-l 32895 -m 32895" : "", b->len - start, gend - gpos);
+        }
+        if( pos >= sz )
+            break;
+
+        // Start a new group with the best options
+        for(int opt = 0; opt < 6; opt++)
+            if( opt != best )
+                free(lz[opt].sp);
+        glz = lz[best];
+        gopt = best;
+        gpos = pos;
+        gnum = 1;
+    }
+    // Maximum values, for the statistics
+    bits_moff = 16;
+    max_llen = max_mlen = 32895;
+    return bits;
+}
+
+// Compress all the data, in frames or interleaved streams if selected.
+// Returns the estimated size in bits.
+static int compress_all(struct bf *b, struct lzop *total, const uint8_t *data, int sz,
+                        int offset_rel, int print_debug, int show_stats)
+{
+    int bits = 0;
+    if( block_size )
+        bits = compress_blocks(b, total, data, sz, offset_rel, print_debug, show_stats);
+    else if( frame_size )
+    {
+        // Each frame is compressed using the previous frame as the window,
+        // the first frame uses a frame of all zeroes.
+        uint8_t *fdata = calloc(2, frame_size);
+        for(int pos = 0; pos < sz; pos += frame_size)
+        {
+            int fsz = -max(-frame_size, pos - sz);
+            memcpy(fdata + frame_size, data + pos, fsz);
+
+            struct lzop lz;
+            int start = b->len;
+            compress(b, &lz, fdata, frame_size + fsz, frame_size, offset_rel, print_debug, b);
+            lzop_add_stats(total, &lz);
+            bits += lzop_bits(&lz);
+            free(lz.sp);
+            if( show_stats > 1 )
+                fprintf(stderr, " Frame %d: %5d / %d bytes\n",
+                        pos / frame_size, b->len - start, fsz);
+
+            memcpy(fdata, fdata + frame_size, frame_size);
+        }
+        free(fdata);
+    }
+    else if( chunk_size )
+        bits = compress_chunks(b, total, data, sz, print_debug, show_stats);
+    else if( num_streams == 1 )
+    {
+        struct lzop lz;
+        struct bf lb = { 0 };
+        int hpos = b->len;
+        if( split_streams )
+        {
+            // Header with the offset of the literals from the start
+            init(&lb);
+            add_byte(b, 0);
+            add_byte(b, 0);
+            bits += 16;
+        }
+        compress(b, &lz, data, sz, preset_size, offset_rel, print_debug, split_streams ? &lb : b);
+        lzop_add_stats(total, &lz);
+        bits += lzop_bits(&lz) + lzop_end_bits(&lz) + hot_num * moff_cost(max_off);
+        free(lz.sp);
+        if( split_streams )
+        {
+            int lstart = b->len - hpos;
+            if( lstart > 0xFFFF )
+                cmd_error("control stream too big for the 16 bit header");
+            b->buf[hpos] = lstart & 0xFF;
+            b->buf[hpos + 1] = lstart >> 8;
+            for(int i = 0; i < lb.len; i++)
+                add_byte(b, lb.buf[i]);
+            free(lb.buf);
+        }
+    }
+    else
+    {
+        // Split input into the interleaved streams, each one is compressed
+        // independently, with a header with the offset of each stream from
+        // the start of the file.
+        uint8_t *sdata = malloc(sz / num_streams + 1);
+        struct bf sb = { 0 };
+        init(&sb);
+        for(int i = 0; i < num_streams; i++)
+        {
+            int ssz = 0;
+            for(int pos = i; pos < sz; pos += num_streams)
+                sdata[ssz++] = data[pos];
+
+            int start = num_streams * 2 + sb.len;
+            if( start > 0xFFFF )
+                cmd_error("compressed streams too big for the 16 bit header");
+            add_byte(b, start & 0xFF);
+            add_byte(b, start >> 8);
+            bits += 16;
+
+            struct lzop lz;
+            compress(&sb, &lz, sdata, ssz, 0, offset_rel, print_debug, &sb);
+            lzop_add_stats(total, &lz);
+            bits += lzop_bits(&lz);
+            free(lz.sp);
+            if( show_stats > 1 )
+                fprintf(stderr, " Stream %d: %5d / %d bytes\n",
+                        i, sb.len + num_streams * 2 - start, ssz);
+        }
+        for(int i = 0; i < sb.len; i++)
+            add_byte(b, sb.buf[i]);
+        free(sb.buf);
+        free(sdata);
+    }
+
+    return bits;
+}
+
+// Clears statistics after compressing multiple times
+static void clear_stats(void)
+{
+    memset(stat_llen, 0, sizeof(int) * (max_llen + 1));
+    memset(stat_mlen, 0, sizeof(int) * (max_mlen + 1));
+    memset(stat_moff, 0, sizeof(int) * (stat_moff_max + 1));
+}
+
+// Tries all filters over the data, returns the one giving the smallest output
+static struct filter select_filter(const uint8_t *data, int sz, int offset_rel)
+{
+    static const struct filter filters[] = {
+        { FILTER_NONE, 0 },       { FILTER_DELTA, 0 },
+        { FILTER_BITPLANE, 2 },   { FILTER_BITPLANE, 4 },   { FILTER_BITPLANE, 8 },
+        { FILTER_TRANSPOSE, 2 },  { FILTER_TRANSPOSE, 3 },  { FILTER_TRANSPOSE, 4 },
+        { FILTER_TRANSPOSE, 8 },  { FILTER_TRANSPOSE, 16 }, { FILTER_TRANSPOSE, 20 },
+        { FILTER_TRANSPOSE, 32 }, { FILTER_TRANSPOSE, 40 }, { FILTER_TRANSPOSE, 48 },
+        { FILTER_COLUMNS, 2 },    { FILTER_COLUMNS, 3 },    { FILTER_COLUMNS, 4 },
+        { FILTER_COLUMNS, 8 },    { FILTER_COLUMNS, 16 },   { FILTER_COLUMNS, 20 },
+        { FILTER_COLUMNS, 32 },   { FILTER_COLUMNS, 40 },   { FILTER_COLUMNS, 48 },
+    };
+    struct filter best = filters[0];
+    int best_size = INT_MAX;
+    uint8_t *fdata = malloc(sz + 1);
+    struct bf tb = { 0 };
+
+    for(unsigned i = 0; i < sizeof(filters) / sizeof(filters[0]); i++)
+    {
+        struct lzop total = { 0 };
+        memcpy(fdata, data, sz);
+        filter_apply(&filters[i], fdata, sz);
+        init(&tb);
+        compress_all(&tb, &total, fdata, sz, offset_rel, 0, 0);
+        if( tb.len < best_size )
+        {
+            best = filters[i];
+            best_size = tb.len;
+        }
+    }
+    free(tb.buf);
+    free(fdata);
+
+    // Clear statistics from all the tries
+    clear_stats();
+    return best;
+}
+
+// Size in bytes of the decoder in "samples/a65-sample.asm" for each option
+// combination, indexed by offset bits (0, 8, 16 or 16 with "-w"), "-x", "-n"
+// and long counts. Variable offsets can't be inverted, size 0 skips those.
+static const int decoder_size[4][2][2][2] = {
+    { { {  71, 102 }, {  71, 102 } }, { {  71, 102 }, {  71, 102 } } },
+    { { {  74, 105 }, {  76, 107 } }, { {  72, 103 }, {  74, 105 } } },
+    { { {  77, 108 }, {  79, 110 } }, { {  73, 104 }, {  75, 106 } } },
+    { { {  93, 124 }, {  95, 126 } }, { {   0,   0 }, {   0,   0 } } },
+};
+
+// Writes the options selected by select_options to the string
+static void selected_options(char *buf, size_t len)
+{
+    snprintf(buf, len, "-o %d%s%s%s%s",
+             bits_moff, exor_offset ? " -x" : "", var_offset ? " -w" : "", zero_offset ? " -n" : "",
+             max_mlen > 255 ? " -l 32895 -m 32895" : "");
+}
+
+// Compresses all the buffers with all the options supported by the sample
+// decoder, and selects the ones giving the smallest total compressed size,
+// plus the decoder size if "decoder" is set.
+static void select_options(const uint8_t **data, const int *sz, int num, int decoder,
+                           int show_stats)
+{
+    int best = INT_MAX, best_o = 0, best_x = 0, best_n = 0, best_lc = 0;
+    struct bf tb = { 0 };
+
+    if( show_stats )
+        fprintf(stderr, " Options                          Data %s  Total\n",
+                decoder ? " Decoder " : "");
+    for(int o = 0; o < 4; o++)
+        for(int n = 0; n < 2; n++)
+            for(int lc = 0; lc < 2; lc++)
+            {
+                int len = 0;
+                bits_moff = o > 2 ? 16 : o * 8;
+                var_offset = o > 2;
+                zero_offset = n;
+                max_llen = max_mlen = lc ? 32895 : 255;
+                for(int i = 0; i < num; i++)
+                {
+                    struct lzop total = { 0 };
+                    init(&tb);
+                    compress_all(&tb, &total, data[i], sz[i], -1, 0, 0);
+                    len += tb.len;
+                }
+                for(int x = 0; x < 2; x++)
+                {
+                    int dsize = decoder_size[o][x][n][lc];
+                    if( !dsize )
+                        continue;
+                    int tlen = len + (decoder ? dsize : 0);
+                    if( show_stats && decoder )
+                        fprintf(stderr, " -o %-2d %-2s %-2s %-19s %6d  %6d  %6d\n",
+                                bits_moff, x ? "-x" : (var_offset ? "-w" : ""), n ? "-n" : "",
+                                lc ? "-l 32895 -m 32895" : "", len, dsize, tlen);
+                    else if( show_stats )
+                        fprintf(stderr, " -o %-2d %-2s %-2s %-19s %6d  %6d\n",
+                                bits_moff, x ? "-x" : (var_offset ? "-w" : ""), n ? "-n" : "",
+                                lc ? "-l 32895 -m 32895" : "", len, tlen);
+                    if( tlen < best )
+                    {
+                        best = tlen;
+                        best_o = o;
+                        best_x = x;
+                        best_n = n;
+                        best_lc = lc;
+                    }
+                }
+            }
+    free(tb.buf);
+    clear_stats();
+
+    bits_moff = best_o > 2 ? 16 : best_o * 8;
+    var_offset = best_o > 2;
+    exor_offset = best_x;
+    zero_offset = best_n;
+    max_llen = max_mlen = best_lc ? 32895 : 255;
+    char opts[64];
+    selected_options(opts, sizeof(opts));
+    fprintf(stderr, "LZ8S: selected options '%s', decoder size %d bytes\n",
+            opts, decoder_size[best_o][best_x][best_n][best_lc]);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Selects the options giving the smallest total size for all the files in
+// the directory, so that all can use the same decoder, and writes those
+// options to the flags file.
+static void tune_corpus(const char *dir, const char *flags_name, int decoder, int show_stats)
+{
+    DIR *d = opendir(dir);
+    if( !d )
+    {
+        fprintf(stderr, "%s: can't open corpus directory '%s': %s\n",
+                prog_name, dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Get all regular files, sorted by name
+    char **names = 0;
+    int num = 0;
+    struct dirent *e;
+    while( (e = readdir(d)) )
+    {
+        struct stat st;
+        char *name = malloc(strlen(dir) + strlen(e->d_name) + 2);
+        sprintf(name, "%s/%s", dir, e->d_name);
+        if( stat(name, &st) || !S_ISREG(st.st_mode) )
+        {
+            free(name);
+            continue;
+        }
+        names = realloc(names, sizeof(char *) * (num + 1));
+        names[num++] = name;
+    }
+    closedir(d);
+    if( !num )
+        cmd_error("no files found in the corpus directory");
+    qsort(names, num, sizeof(char *), compare_names);
+
+    // Read all files
+    const uint8_t **data = malloc(sizeof(uint8_t *) * num);
+    int *sz = malloc(sizeof(int) * num);
+    int total = 0;
+    for(int i = 0; i < num; i++)
+    {
+        FILE *f = fopen(names[i], "rb");
+        if( !f )
+        {
+            fprintf(stderr, "%s: can't open input file '%s': %s\n",
+                    prog_name, names[i], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        data[i] = read_data(f, &sz[i]);
+        fclose(f);
+        total += sz[i];
+        if( show_stats > 1 )
+            fprintf(stderr, " %6d  %s\n", sz[i], names[i]);
+    }
+    fprintf(stderr, "LZ8S: tuning options for %d files, %d bytes\n", num, total);
+
+    select_options(data, sz, num, decoder, show_stats);
+
+    // Write the flags file
+    char opts[64];
+    selected_options(opts, sizeof(opts));
+    FILE *out = stdout;
+    if( flags_name )
+    {
+        out = fopen(flags_name, "w");
+        if( !out )
+        {
+            fprintf(stderr, "%s: can't open flags file '%s': %s\n",
+                    prog_name, flags_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    fprintf(out, "%s\n", opts);
+    if( out != stdout )
+        fclose(out);
+
+    for(int i = 0; i < num; i++)
+    {
+        free((void *)data[i]);
+        free(names[i]);
+    }
+    free(data);
+    free(sz);
+    free(names);
+}
+
+// Number of hashes in the MinHash sketch of each file
+#define SKETCH_SIZE     64
+
+// Calculates the MinHash sketch of the data: the minimum of each hash
+// function over all the 4 byte sequences. The fraction of equal values in two
+// sketches estimates the similarity of the files.
+static void minhash_sketch(const uint8_t *data, int sz, uint32_t *sk)
+{
+    uint32_t x = 0;
+    for(int i = 0; i < SKETCH_SIZE; i++)
+        sk[i] = UINT32_MAX;
+    for(int p = 0; p < sz; p++)
+    {
+        x = (x << 8) | data[p];
+        if( p < 3 )
+            continue;
+        uint32_t h = x * 0x9E3779B1u;
+        h ^= h >> 15;
+        for(int i = 0; i < SKETCH_SIZE; i++)
+        {
+            uint32_t v = (h ^ (i * 0x27D4EB2Fu)) * 0x85EBCA6Bu;
+            v ^= v >> 16;
+            if( v < sk[i] )
+                sk[i] = v;
+        }
+    }
+}
+
+// Returns the base name of the path
+static const char *base_name(const char *path)
+{
+    const char *p = strrchr(path, '/');
+    return p ? p + 1 : path;
+}
+
+// Initial time of one match search step, in seconds, before measuring
+#define STEP_TIME       1e-8
+
+// Returns the number of candidates tested plus bytes compared by the match
+// search at pos, without the search stride, and the longest match length.
+static long match_steps(const uint8_t *data, const int *chain, int pos, int size, int *mlen)
+{
+    int mxlen = -max(-max_mlen, pos - size);
+    int first = max(pos - max_off, 0);
+    int n = 0;
+    long steps = 0;
+    *mlen = 0;
+    for(int i = chain ? chain[pos] : first; i >= first && i < pos; i = chain ? chain[i] : i + 1)
+    {
+        int ml = get_mlen(data + pos, data + i, mxlen);
+        steps += ml + 1;
+        if( ml > *mlen )
+            *mlen = ml;
+        if( ml >= mxlen || (chain && ++n >= MAX_CHAIN) )
+            break;
+    }
+    return steps;
+}
+
+// Estimates the work to compress the data after "start", in match search
+// steps: the steps of the match search and the match lengths tested by the
+// parser, measured on a sample of positions. Also returns the average match
+// length found in the sample.
+static double estimate_work(const uint8_t *data, int sz, int start, double *avg_mlen)
+{
+    struct lzop lz;
+    long steps = 0, mlen = 0;
+    int n = -max(-64, start - sz);
+    *avg_mlen = 0;
+    if( n <= 0 )
+        return 0;
+    lzop_init(&lz, data, sz, start);
+    for(int i = 0; i < n; i++)
+    {
+        int ml, pos = start + (int)((long long)(sz - start) * (2 * i + 1) / (2 * n));
+        steps += match_steps(data, lz.chain, pos, sz, &ml);
+        mlen += ml;
+    }
+    free(lz.sp);
+    free(lz.chain);
+    *avg_mlen = (double)mlen / n;
+    return (double)(sz - start) * (steps + mlen) / n;
+}
+
+// Compresses the data with the reference as preset window, returns the size,
+// and adds the estimated work to "work" if not null.
+static int compress_preset(struct bf *b, const uint8_t *ref, int rsz,
+                           const uint8_t *data, int sz, double *work)
+{
+    uint8_t *buf = malloc(rsz + sz + 1);
+    memcpy(buf, ref, rsz);
+    memcpy(buf + rsz, data, sz);
+    if( work )
+    {
+        double mlen;
+        *work += estimate_work(buf, rsz + sz, rsz, &mlen);
+    }
+    struct lzop total = { 0 };
+    preset_size = rsz;
+    init(b);
+    compress_all(b, &total, buf, rsz + sz, -1, 0, 0);
+    preset_size = 0;
+    free(buf);
+    return b->len;
+}
+
+// Entry in the manifest of a batch: output, input and reference file names
+struct manifest_entry
+{
+    char out[1024];
+    char in[1024];
+    char ref[1024];
+};
+
+// Writes all the options that change the compressed output to the string,
+// stored in the manifest so that outputs of other options are not reused.
+static void batch_options(char *buf, size_t len)
+{
+    snprintf(buf, len, "options -o %d -l %d -m %d -k %d%s%s%s%s%s%s%s -s %d%s\n",
+             bits_moff, max_llen, max_mlen, hot_num, exor_offset ? " -x" : "",
+             var_offset ? " -w" : "", zero_offset ? " -n" : "", rep_offset ? " -r" : "",
+             nibble_tokens ? " -t" : "", split_streams ? " -p" : "", end_marker ? " -e" : "",
+             stride, stride_only ? " -S" : "");
+}
+
+// Reads the manifest of a previous batch, returns the number of entries, or
+// 0 if the manifest was written with other options.
+static int read_manifest(const char *name, struct manifest_entry **list)
+{
+    struct manifest_entry e;
+    char opts[256], line[256];
+    int num = 0;
+    FILE *f = fopen(name, "r");
+    *list = 0;
+    if( !f )
+        return 0;
+    batch_options(opts, sizeof(opts));
+    if( !fgets(line, sizeof(line), f) || strcmp(line, opts) )
+    {
+        fclose(f);
+        return 0;
+    }
+    while( 3 == fscanf(f, "%1023s %1023s %1023s", e.out, e.in, e.ref) )
+    {
+        *list = realloc(*list, sizeof(e) * (num + 1));
+        (*list)[num++] = e;
+    }
+    fclose(f);
+    return num;
+}
+
+// Checks if the output file of the previous batch can be reused: the input
+// and the candidate reference are older than the output, and the manifest
+// has the same input with the candidate or no reference. Returns the
+// reference used, or 0 if the output must be compressed again.
+static const char *batch_uptodate(const char *oname, const char *in, const char *cand,
+                                  const struct manifest_entry *list, int num)
+{
+    struct stat so, st;
+    for(int i = 0; i < num; i++)
+    {
+        const struct manifest_entry *e = &list[i];
+        if( strcmp(e->out, base_name(oname)) || strcmp(e->in, in) )
+            continue;
+        if( strcmp(e->ref, "-") && (!cand || strcmp(e->ref, cand)) )
+            return 0;
+        // With timestamps in seconds, an equal time is not up to date
+        if( stat(oname, &so) || stat(in, &st) || so.st_mtime <= st.st_mtime )
+            return 0;
+        if( cand && (stat(cand, &st) || so.st_mtime <= st.st_mtime) )
+            return 0;
+        return e->ref;
+    }
+    return 0;
+}
+
+// Compresses all the files to the output directory, each one with the most
+// similar of the previous files as the preset window when that gives a
+// smaller output, and writes a manifest with the reference of each file.
+// In update mode, the outputs that are up to date are not compressed again.
+static void compress_batch(const char *out_dir, char **names, int num, int show_stats,
+                           int show_timing, int update)
+{
+    uint8_t **data = malloc(sizeof(uint8_t *) * num);
+    int *sz = malloc(sizeof(int) * num);
+    uint32_t *sketch = malloc(sizeof(uint32_t) * SKETCH_SIZE * num);
+    int max_sz = 0;
+
+    // Read all files and calculate the sketches
+    for(int i = 0; i < num; i++)
+    {
+        // The manifest separates the names with spaces
+        if( strpbrk(names[i], " \t\n") || strlen(names[i]) > 1000 )
+            cmd_error("file names with spaces or longer than 1000 characters can't be used in batch mode");
+        for(int j = 0; j < i; j++)
+            if( !strcmp(base_name(names[i]), base_name(names[j])) )
+                cmd_error("duplicated file names in batch mode");
+        FILE *f = fopen(names[i], "rb");
+        if( !f )
+        {
+            fprintf(stderr, "%s: can't open input file '%s': %s\n",
+                    prog_name, names[i], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        data[i] = read_data(f, &sz[i]);
+        fclose(f);
+        max_sz = max(max_sz, sz[i]);
+        minhash_sketch(data[i], sz[i], sketch + i * SKETCH_SIZE);
+    }
+    if( 2 * max_sz > MAX_INPUT_SIZE )
+        cmd_error("input file too big, maximum is 16MB in batch mode");
+
+    // Alloc statistic arrays, the offset can reach the start of the preset
+    stat_moff_max = bits_moff > 16 ? -max(-max_off, -2 * max_sz) : max_off;
+    stat_llen = calloc(sizeof(int), max_llen + 1);
+    stat_mlen = calloc(sizeof(int), max_mlen + 1);
+    stat_moff = calloc(sizeof(int), stat_moff_max + 1);
+
+    char *mname = malloc(strlen(out_dir) + 16);
+    sprintf(mname, "%s/manifest.txt", out_dir);
+    struct manifest_entry *old = 0;
+    int old_num = update ? read_manifest(mname, &old) : 0;
+    FILE *manifest = fopen(mname, "w");
+    if( !manifest )
+    {
+        fprintf(stderr, "%s: can't open manifest file '%s': %s\n",
+                prog_name, mname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char opts[256];
+    batch_options(opts, sizeof(opts));
+    fputs(opts, manifest);
+
+    // Estimate the time of each file, without references
+    double *work = malloc(sizeof(double) * num), step_time = STEP_TIME;
+    double total_work = 0, total_time = 0, total_pred = 0;
+    if( show_timing )
+    {
+        int longest = 0;
+        for(int i = 0; i < num; i++)
+        {
+            double mlen;
+            work[i] = estimate_work(data[i], sz[i], 0, &mlen);
+            total_pred += work[i] * step_time;
+            if( work[i] > work[longest] )
+                longest = i;
+            fprintf(stderr, "LZ8S: time %-24s %6d bytes, window %d, match length %5.1f,"
+                    " %8.0f steps\n", base_name(names[i]), sz[i], -max(-max_off, -sz[i]),
+                    mlen, work[i]);
+        }
+        fprintf(stderr, "LZ8S: time for %d files predicted %.3fs, longest %s;"
+                " one worker, files compressed in order\n",
+                num, total_pred, base_name(names[longest]));
+        total_pred = 0;
+    }
+
+    struct bf b = { 0 }, rb = { 0 };
+    int in_total = 0, out_total = 0;
+    for(int i = 0; i < num; i++)
+    {
+        // Search the most similar of the previous files
+        int ref = -1, best_sim = 0;
+        for(int j = 0; j < i && sz[i] >= 4; j++)
+        {
+            int sim = 0;
+            for(int k = 0; k < SKETCH_SIZE; k++)
+                sim += sketch[i * SKETCH_SIZE + k] == sketch[j * SKETCH_SIZE + k];
+            if( sz[j] >= 4 && sim > best_sim )
+            {
+                best_sim = sim;
+                ref = j;
+            }
+        }
+
+        char *oname = malloc(strlen(out_dir) + strlen(base_name(names[i])) + 8);
+        sprintf(oname, "%s/%s.lz8", out_dir, base_name(names[i]));
+
+        // Keep the output if up to date
+        const char *uref = batch_uptodate(oname, names[i], ref >= 0 ? names[ref] : 0,
+                                          old, old_num);
+        if( uref )
+        {
+            struct stat so;
+            stat(oname, &so);
+            fprintf(manifest, "%s %s %s\n", base_name(oname), names[i], uref);
+            if( show_stats )
+                fprintf(stderr, "LZ8S: %-24s %6d / %6d, up to date\n", base_name(oname),
+                        (int)so.st_size, sz[i]);
+            in_total += sz[i];
+            out_total += so.st_size;
+            free(oname);
+            continue;
+        }
+
+        // Compress without and with the reference, keep the smallest
+        clock_t t0 = clock();
+        double rwork = 0;
+        int len = compress_preset(&b, 0, 0, data[i], sz[i], 0);
+        if( ref >= 0 && compress_preset(&rb, data[ref], sz[ref], data[i], sz[i],
+                                        show_timing ? &rwork : 0) < len )
+        {
+            struct bf t = b;
+            b = rb;
+            rb = t;
+            len = b.len;
+        }
+        else
+            ref = -1;
+
+        // Compare the predicted time with the measured, and adjust the time
+        // of one step with the measured times.
+        if( show_timing )
+        {
+            double t = (double)(clock() - t0) / CLOCKS_PER_SEC;
+            double w = work[i] + rwork;
+            fprintf(stderr, "LZ8S: time %-24s predicted %.3fs, actual %.3fs\n",
+                    base_name(names[i]), w * step_time, t);
+            total_pred += w * step_time;
+            total_work += w;
+            total_time += t;
+            if( total_work > 0 && total_time > 0 )
+                step_time = total_time / total_work;
+        }
+
+        // Write the output file and the manifest line
+        b.out = fopen(oname, "wb");
+        if( !b.out )
+        {
+            fprintf(stderr, "%s: can't open output file '%s': %s\n",
+                    prog_name, oname, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        bflush(&b);
+        fclose(b.out);
+        fprintf(manifest, "%s %s %s\n", base_name(oname), names[i], ref >= 0 ? names[ref] : "-");
+        if( show_stats )
+        {
+            fprintf(stderr, "LZ8S: %-24s %6d / %6d = %6.2f%%", base_name(oname), len, sz[i],
+                    sz[i] ? (100.0 * len) / sz[i] : 0);
+            if( ref >= 0 )
+                fprintf(stderr, ", reference %s, similarity %d of %d\n",
+                        base_name(names[ref]), best_sim, SKETCH_SIZE);
+            else
+                fprintf(stderr, "\n");
+        }
+        in_total += sz[i];
+        out_total += len;
+        free(oname);
+    }
+    fclose(manifest);
+    fprintf(stderr, "LZ8S: batch of %d files, ratio: %5d / %d = %5.2f%%\n",
+            num, out_total, in_total, in_total ? (100.0 * out_total) / in_total : 0);
+    if( show_timing )
+        fprintf(stderr, "LZ8S: time for %d files predicted %.3fs, actual %.3fs\n",
+                num, total_pred, total_time);
+
+    for(int i = 0; i < num; i++)
+        free(data[i]);
+    free(data);
+    free(sz);
+    free(sketch);
+    free(work);
+    free(old);
+    free(mname);
+    free(b.buf);
+    free(rb.buf);
+    free(stat_llen);
+    free(stat_mlen);
+    free(stat_moff);
+}
+
+///////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+    struct bf b = { 0 };
+    uint8_t *data;
+    int show_stats = 1;
+    int offset_rel = -1;
     int print_debug = 0;
+    int auto_filter = 0;
+    int min_total = 0;
+    struct filter filter = { FILTER_NONE, 0 };
+    const char *tune_dir = 0;
+    const char *preset_name = 0;
+    int batch_mode = 0;
+    int show_timing = 0;
+    int update = 0;
 
     prog_name = argv[0];
     int opt;
-    while( -1 != (opt = getopt(argc, argv, "hqvnxdo:l:m:A:")) )
+    while( -1 != (opt = getopt(argc, argv, "hqvnxwrtpedMbTuo:l:m:A:i:F:B:k:s:S:f:c:P:C:D:")) )
     {
         switch(opt)
         {
@@ -489,6 +2156,31 @@ int main(int argc, char **argv)
             case 'A':
                 offset_rel = strtol(optarg, 0, 0);
                 break;
+            case 'i':
+                num_streams = atoi(optarg);
+                break;
+            case 'F':
+                frame_size = atoi(optarg);
+                break;
+            case 'B':
+                block_size = atoi(optarg);
+                break;
+            case 'k':
+                hot_num = atoi(optarg);
+                break;
+            case 's':
+                stride = atoi(optarg);
+                stride_only = 0;
+                break;
+            case 'S':
+                stride = atoi(optarg);
+                stride_only = 1;
+                break;
+            case 'f':
+                auto_filter = !strcmp(optarg, "auto");
+                if( !auto_filter && filter_parse(&filter, optarg) )
+                    cmd_error("invalid filter, use delta, transpose:W, bitplane:N, columns:W or auto");
+                break;
             case 'd':
                 print_debug = 1;
                 break;
@@ -498,6 +2190,45 @@ int main(int argc, char **argv)
             case 'n':
                 zero_offset = 1;
                 break;
+            case 'w':
+                var_offset = 1;
+                break;
+            case 'r':
+                rep_offset = 1;
+                break;
+            case 't':
+                nibble_tokens = 1;
+                break;
+            case 'p':
+                split_streams = 1;
+                break;
+            case 'e':
+                end_marker = 1;
+                break;
+            case 'M':
+                min_total = 1;
+                break;
+            case 'c':
+                tune_dir = optarg;
+                break;
+            case 'P':
+                preset_name = optarg;
+                break;
+            case 'b':
+                batch_mode = 1;
+                break;
+            case 'T':
+                show_timing = 1;
+                break;
+            case 'u':
+                update = 1;
+                break;
+            case 'C':
+                chunk_size = atoi(optarg);
+                break;
+            case 'D':
+                cache_dir = optarg;
+                break;
             case 'v':
                 show_stats = 2;
                 break;
@@ -510,33 +2241,126 @@ int main(int argc, char **argv)
                        "LZ8S-X ultra-simple LZ based compressor - by dmsc.\n"
                        "\n"
                        "Usage: %s [options] <input_file> <output_file>\n"
+                       "       %s -b [options] <output_dir> <input_files...>\n"
                        "\n"
                        "If output_file is omitted, write to standard output, and if\n"
                        "input_file is also omitted, read from standard input.\n"
                        "\n"
                        "Options:\n"
-                       "  -o BITS  Sets match offset bits (default = %d).\n"
+                       "  -o BITS  Sets match offset bits, up to 32 (default = %d).\n"
                        "  -l NUM   Sets max literal run length (default = %d).\n"
                        "  -m NUM   Sets max match run length (default = %d).\n"
                        "  -A ADDR  Encode position relative to address instead of offset.\n"
+                       "  -i NUM   Compress NUM byte-interleaved streams independently.\n"
+                       "  -F SIZE  Compress frames of SIZE bytes from the previous frame.\n"
+                       "  -B SIZE  Select offset bits and max lengths on each block of SIZE bytes.\n"
+                       "  -C SIZE  Compress chunks split by content, of SIZE bytes on average.\n"
+                       "  -D DIR   Store compressed chunks, or the match index, in DIR to reuse\n"
+                       "           in later runs.\n"
+                       "  -s NUM   Search match offsets multiple of NUM first.\n"
+                       "  -S NUM   Search only match offsets multiple of NUM or up to 16.\n"
+                       "  -f NAME  Filter data before compression, one of 'delta',\n"
+                       "           'transpose:W', 'bitplane:N', 'columns:W' or 'auto'.\n"
                        "  -n       Do not omit match offset on zero match length.\n"
                        "  -x       Write offsets with bits inverted.\n"
+                       "  -w       Write offsets less than 128 in one byte, others in two.\n"
+                       "  -r       Match counts with top bit set repeat the last offset,\n"
+                       "           limits max match run length to 127.\n"
+                       "  -t       Write literal and match counts in one byte of two nibbles.\n"
+                       "  -p       Write literal bytes in a separate stream after the counts.\n"
+                       "  -e       Write an end marker, a zero literal and zero match count.\n"
+                       "  -k NUM   Write matches with the NUM most used offsets in the count\n"
+                       "           byte, NUM is 1, 2, 4, 8 or 16. Limits max match length to 127.\n"
+                       "  -M       Select options giving minimal data plus decoder size, only\n"
+                       "           from -o, -x, -w, -n and long counts; not with -r, -k or -e.\n"
+                       "  -c DIR   Select options giving minimal total size for all files in\n"
+                       "           DIR, with -M also adding the decoder size, and write\n"
+                       "           those options to the output file instead of compressing.\n"
+                       "  -P FILE  Use the data in FILE as the initial window.\n"
+                       "  -b       Batch mode, compress all input files to the output\n"
+                       "           directory, using the most similar previous file as the\n"
+                       "           initial window, and write a manifest with those files.\n"
+                       "  -T       Shows predicted and measured compression time in batch mode.\n"
+                       "  -u       Compress only the changed files in batch mode.\n"
                        "  -v       Shows match length/offset statistics.\n"
                        "  -d       Shows debug information on compression chain.\n"
                        "  -q       Don't show detailed compression stats.\n"
                        "  -h       Shows this help.\n",
-                       prog_name, bits_moff, max_llen, max_mlen);
+                       prog_name, prog_name, bits_moff, max_llen, max_mlen);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // Repeat and hot offsets use the top bit of the match count
+    if( (rep_offset || hot_num) && max_mlen > 127 )
+        max_mlen = 127;
+    if( hot_num > 0 )
+        hot_mlen = 128 / hot_num;
+
     // Check option values
     if( max_mlen < 1 || max_mlen > 32895 )
         cmd_error("max match run length should be from 1 to 32895");
     if( max_llen < 1 || max_llen > 32895 )
         cmd_error("max literal run length should be from 1 to 32895");
-    if( bits_moff < 0 || bits_moff > 16 )
-        cmd_error("match offset bits should be from 0 to 16");
+    if( num_streams < 1 || num_streams > 255 )
+        cmd_error("number of interleaved streams should be from 1 to 255");
+    if( frame_size < 0 || frame_size > 65536 )
+        cmd_error("frame size should be from 1 to 65536");
+    if( stride < 0 || stride > 65535 || (stride_only && !stride) )
+        cmd_error("stride should be from 1 to 65535");
+    if( frame_size && num_streams > 1 )
+        cmd_error("frames and interleaved streams can't be used together");
+    if( block_size < 0 || block_size > 65536 )
+        cmd_error("block size should be from 1 to 65536");
+    if( block_size && (frame_size || num_streams > 1 || offset_rel >= 0 || var_offset ||
+                       rep_offset || nibble_tokens || min_total) )
+        cmd_error("adaptive blocks can't be used with -F, -i, -A, -w, -r, -t or -M");
+    if( min_total && (frame_size || num_streams > 1 || offset_rel >= 0 || rep_offset ||
+                      nibble_tokens || split_streams || end_marker || hot_num) )
+        cmd_error("minimal total size only supported for the sample decoder options");
+    if( tune_dir && (frame_size || num_streams > 1 || offset_rel >= 0 || rep_offset ||
+                     nibble_tokens || split_streams || end_marker || block_size || hot_num ||
+                     auto_filter || filter.type != FILTER_NONE) )
+        cmd_error("corpus tuning only supported for the sample decoder options, without -f");
+    if( (preset_name || batch_mode) && (frame_size || num_streams > 1 || offset_rel >= 0 ||
+                                        block_size || min_total || tune_dir ||
+                                        auto_filter || filter.type != FILTER_NONE) )
+        cmd_error("preset window and batch mode can't be used with -F, -i, -A, -B, -M, -c or -f");
+    if( preset_name && batch_mode )
+        cmd_error("preset window and batch mode can't be used together");
+    if( show_timing && !batch_mode )
+        cmd_error("compression time only shown in batch mode");
+    if( update && !batch_mode )
+        cmd_error("update only available in batch mode");
+    if( chunk_size && (chunk_size < 256 || chunk_size > 8192 || (chunk_size & (chunk_size - 1))) )
+        cmd_error("chunk size should be a power of two from 256 to 8192");
+    if( chunk_size && (frame_size || num_streams > 1 || offset_rel >= 0 || block_size ||
+                       split_streams || end_marker || hot_num || min_total || tune_dir ||
+                       preset_name || batch_mode) )
+        cmd_error("chunks can't be used with -F, -i, -A, -B, -p, -e, -k, -M, -c, -P or -b");
+    if( chunk_size && bits_moff > 16 )
+        cmd_error("chunks need offsets of up to 16 bits");
+    if( frame_size && offset_rel >= 0 && frame_size > max_off )
+        cmd_error("frame size should not be bigger than the window with relative address");
+    if( bits_moff < 0 || bits_moff > 32 )
+        cmd_error("match offset bits should be from 0 to 32");
+    if( bits_moff > 16 && (frame_size || stride) )
+        cmd_error("frames and search stride need offsets of up to 16 bits");
+    if( nibble_tokens && rep_offset )
+        cmd_error("repeat offsets can't be used with tokens");
+    if( split_streams && (frame_size || num_streams > 1 || block_size) )
+        cmd_error("split streams can't be used with -F, -i or -B");
+    if( end_marker && (frame_size || num_streams > 1 || block_size) )
+        cmd_error("end marker can't be used with -F, -i or -B");
+    if( hot_num < 0 || hot_num > 16 || (hot_num & (hot_num - 1)) )
+        cmd_error("number of hot offsets should be 1, 2, 4, 8 or 16");
+    if( hot_num && (!bits_moff || bits_moff > 16 || rep_offset || nibble_tokens || var_offset ||
+                    offset_rel >= 0 || frame_size || num_streams > 1 || block_size || min_total) )
+        cmd_error("hot offsets need 1 to 16 offset bits, without -r, -t, -w, -A, -F, -i, -B or -M");
+    if( rep_offset && (!bits_moff || offset_rel >= 0) )
+        cmd_error("repeat offsets need match offsets, without -A");
+    if( var_offset && (bits_moff <= 8 || bits_moff > 16 || exor_offset || offset_rel >= 0) )
+        cmd_error("variable offsets need from 9 to 16 offset bits, without -x or -A");
     if(bits_moff == 8)
     {
         if(offset_rel > 0xFF)
@@ -547,8 +2371,38 @@ int main(int argc, char **argv)
         if( offset_rel > 0xFFFF )
             cmd_error("relative address should be less than 65536");
     }
+    else if(bits_moff > 16)
+    {
+        if( offset_rel >= max_off )
+            cmd_error("relative address should be less than the maximum offset");
+    }
     else if(offset_rel >= 0)
-        cmd_error("relative address works only with 8 or 16 bit offsets");
+        cmd_error("relative address works only with 8 bit or 16 to 32 bit offsets");
+
+    if( tune_dir )
+    {
+        if( optind < argc-1 )
+            cmd_error("too many arguments: only the flags file expected with -c");
+        // Alloc statistic arrays with maximum sizes for all options
+        stat_moff_max = 65536;
+        stat_llen = calloc(sizeof(int), 32895 + 1);
+        stat_mlen = calloc(sizeof(int), 32895 + 1);
+        stat_moff = calloc(sizeof(int), stat_moff_max + 1);
+        tune_corpus(tune_dir, optind < argc ? argv[optind] : 0, min_total, show_stats);
+        free(stat_llen);
+        free(stat_mlen);
+        free(stat_moff);
+        return 0;
+    }
+
+    if( batch_mode )
+    {
+        if( optind > argc-2 )
+            cmd_error("output directory and input files expected in batch mode");
+        compress_batch(argv[optind], argv + optind + 1, argc - optind - 1, show_stats,
+                       show_timing, update);
+        return 0;
+    }
 
     if( optind < argc-2 )
         cmd_error("too many arguments: one input file and one output file expected");
@@ -567,22 +2421,58 @@ int main(int argc, char **argv)
     // Set stdin and stdout as binary files
     set_binary();
 
-    // Alloc statistic arrays
-    stat_llen = calloc(sizeof(int), max_llen + 1);
-    stat_mlen = calloc(sizeof(int), max_mlen + 1);
-    stat_moff = calloc(sizeof(int), max_off + 1);
-
-    // Max size of bufer: 128k
-    data = malloc(128*1024); // calloc(128,1024);
-    lpos = -1;
-
     // Read all data
-    int sz = fread(data, 1, 128*1024, input_file);
+    int sz;
+    data = read_data(input_file, &sz);
+
+    // Read the preset window, and place it before the data
+    if( preset_name )
+    {
+        FILE *f = fopen(preset_name, "rb");
+        if( !f )
+        {
+            fprintf(stderr, "%s: can't open preset file '%s': %s\n",
+                    prog_name, preset_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        uint8_t *pdata = read_data(f, &preset_size);
+        fclose(f);
+        if( preset_size + sz > MAX_INPUT_SIZE )
+            cmd_error("input file too big, maximum is 32MB including the preset");
+        pdata = realloc(pdata, preset_size + sz + 1);
+        memcpy(pdata + preset_size, data, sz);
+        free(data);
+        data = pdata;
+    }
 
     // Close file
     if( input_file != stdin )
         fclose(input_file);
 
+    // Alloc statistic arrays, with maximum sizes when selecting options,
+    // with big windows the offset is limited by the data size.
+    int all_opts = min_total || block_size;
+    stat_moff_max = all_opts ? 65536 : bits_moff > 16 ? -max(-max_off, -(preset_size + sz)) : max_off;
+    stat_llen = calloc(sizeof(int), (all_opts ? 32895 : max_llen) + 1);
+    stat_mlen = calloc(sizeof(int), (all_opts ? 32895 : max_mlen) + 1);
+    stat_moff = calloc(sizeof(int), stat_moff_max + 1);
+
+    // Select best filter and apply
+    if( auto_filter )
+    {
+        char name[64];
+        filter = select_filter(data, sz, offset_rel);
+        fprintf(stderr, "LZ8S: selected filter '%s'\n", filter_name(&filter, name, 64));
+    }
+    filter_apply(&filter, data, sz);
+
+    // Select best options for the sample decoder
+    if( min_total )
+    {
+        const uint8_t *all[1] = { data };
+        select_options(all, &sz, 1, 1, show_stats);
+    }
+
     // Open output file if needed
     FILE *output_file = stdout;
     if( optind < argc-1 )
@@ -599,24 +2489,14 @@ int main(int argc, char **argv)
     b.out = output_file;
     init(&b);
 
-    // Init LZ state
-    struct lzop lz;
-    lzop_init(&lz, data, sz);
-    lzop_backfill(&lz);
-
-    // Write encode walk:
-    if(print_debug)
-        debug_encode(&lz, sz);
-
     // Compress
-    init(&b);
-    for(int pos = 0; pos < sz; pos++)
-        lpos = lzop_encode(&b, &lz, pos, lpos, offset_rel);
+    struct lzop total = { 0 };
+    int bits = compress_all(&b, &total, data, preset_size + sz, offset_rel, print_debug, show_stats);
 
     bflush(&b);
     // Close file
     if( output_file != stdout )
-        fclose(input_file);
+        fclose(output_file);
     else
         fflush(stdout);
 
@@ -629,7 +2509,6 @@ int main(int argc, char **argv)
     {
         double total1 = 100.0 / sz;
         double total2 = 100.0 / b.total;
-        int bits = lz.sp[0].mbits < lz.sp[0].lbits ? lz.sp[0].mbits : lz.sp[0].lbits;
         if( b.total * 8 - bits )
         {
             fprintf(stderr,
@@ -644,19 +2523,35 @@ int main(int argc, char **argv)
                         " Bytes encoded as literal: %5d bytes,  %4.1f%%   %4.1f%%\n"
                         " Total matches overhead: %7d bits,     -     %4.1f%%\n"
                         " Total literal overhead: %7d bits,     -     %4.1f%%\n",
-                lz.num_matches, lz.num_literal, lz.num_literal0,
-                lz.bytes_matches, total1 * lz.bytes_matches,
-                lz.bytes_literal, total1 * lz.bytes_literal, total2 * lz.bytes_literal,
-                lz.bits_matches, total2 * 0.125 * lz.bits_matches,
-                lz.bits_literal, total2 * 0.125 * lz.bits_literal);
+                total.num_matches, total.num_literal, total.num_literal0,
+                total.bytes_matches, total1 * total.bytes_matches,
+                total.bytes_literal, total1 * total.bytes_literal, total2 * total.bytes_literal,
+                total.bits_matches, total2 * 0.125 * total.bits_matches,
+                total.bits_literal, total2 * 0.125 * total.bits_literal);
+
+        if( show_stats > 1 && stride )
+            fprintf(stderr, " Matches with offset not multiple of stride: %d of %d\n",
+                    total.num_nostride, total.num_matches);
+        if( show_stats > 1 && rep_offset )
+            fprintf(stderr, " Matches with repeated offset: %d of %d\n",
+                    total.num_repeat, total.num_matches);
+        if( show_stats > 1 && hot_num )
+        {
+            fprintf(stderr, " Matches with hot offset: %d of %d\n Hot offsets:",
+                    total.num_hot, total.num_matches);
+            for(int i = 0; i < hot_num; i++)
+                fprintf(stderr, " %d", hot_off[i]);
+            fprintf(stderr, "\n");
+        }
 
         if( show_stats > 1 )
         {
             fprintf(stderr,"\nvalue\t  MPOS\t  MLEN\t  LLEN\n");
-            for(int i=0; i<=max_mlen || i<=max_off || i<=max_llen; i++)
+            int moff = -max(-max_off, -stat_moff_max);
+            for(int i=0; i<=max_mlen || i<=moff || i<=max_llen; i++)
             {
                 fprintf(stderr,"%2d\t%5d\t%5d\t%5d\n", i,
-                        (i <= max_off) ? stat_moff[i] : 0,
+                        (i <= moff) ? stat_moff[i] : 0,
                         (i <= max_mlen) ? stat_mlen[i] : 0,
                         (i <= max_llen) ? stat_llen[i] : 0);
             }
@@ -666,6 +2561,8 @@ int main(int argc, char **argv)
     free(stat_llen);
     free(stat_mlen);
     free(stat_moff);
+    free(b.buf);
+    free(data);
     return 0;
 }
 